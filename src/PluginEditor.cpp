@@ -9,13 +9,33 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 
+#define AYUMI_EDITOR_STATS_HEIGHT 280
+#define AYUMI_EDITOR_STATS_REFRESH_HZ 4
+
 //==============================================================================
 AyumiAudioProcessorEditor::AyumiAudioProcessorEditor (AyumiAudioProcessor& p)
-    : AudioProcessorEditor (&p), audioProcessor (p)
+    : AudioProcessorEditor (&p), audioProcessor (p), parameters (p)
 {
-    // Make sure that before the constructor has finished, you've set the
-    // editor's size to whatever you need it to be.
-    setSize (400, 300);
+    addAndMakeVisible (parameters);
+   #if AYUMI_JUCE_INSTRUMENTATION
+    statsView.setMultiLine (true);
+    statsView.setReadOnly (true);
+    statsView.setFont (juce::Font (juce::Font::getDefaultMonospacedFontName(), 12.0f, juce::Font::plain));
+    addAndMakeVisible (statsView);
+    // dumps the statistics on demand, to the log and the clipboard.
+    dumpButton.onClick = [this] {
+        auto report = audioProcessor.getProcessStats().toString (audioProcessor.getProcessSampleRate());
+        juce::Logger::writeToLog (report);
+        juce::SystemClipboard::copyTextToClipboard (report);
+    };
+    addAndMakeVisible (dumpButton);
+    resetButton.onClick = [this] { audioProcessor.getProcessStats().requestReset(); };
+    addAndMakeVisible (resetButton);
+    startTimerHz (AYUMI_EDITOR_STATS_REFRESH_HZ);
+    setSize (parameters.getWidth(), parameters.getHeight() + AYUMI_EDITOR_STATS_HEIGHT);
+   #else
+    setSize (parameters.getWidth(), parameters.getHeight());
+   #endif
 }
 
 AyumiAudioProcessorEditor::~AyumiAudioProcessorEditor()
@@ -27,14 +47,25 @@ void AyumiAudioProcessorEditor::paint (juce::Graphics& g)
 {
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
-
-    g.setColour (juce::Colours::black);
-    g.setFont (30.0f);
-    g.drawFittedText ("Hello World!", getLocalBounds(), juce::Justification::centred, 1);
 }
 
 void AyumiAudioProcessorEditor::resized()
 {
-    // This is generally where you'll want to lay out the positions of any
-    // subcomponents in your editor..
+    auto bounds = getLocalBounds();
+   #if AYUMI_JUCE_INSTRUMENTATION
+    auto stats = bounds.removeFromBottom (AYUMI_EDITOR_STATS_HEIGHT);
+    auto buttons = stats.removeFromTop (28).reduced (4);
+    dumpButton.setBounds (buttons.removeFromLeft (80));
+    buttons.removeFromLeft (4);
+    resetButton.setBounds (buttons.removeFromLeft (80));
+    statsView.setBounds (stats.reduced (4));
+   #endif
+    parameters.setBounds (bounds);
+}
+
+void AyumiAudioProcessorEditor::timerCallback()
+{
+   #if AYUMI_JUCE_INSTRUMENTATION
+    statsView.setText (audioProcessor.getProcessStats().toString (audioProcessor.getProcessSampleRate()), false);
+   #endif
 }
@@ -13,8 +13,10 @@
 
 //==============================================================================
 /**
+    The generic parameter editor, plus the processing statistics in builds with
+    AYUMI_JUCE_INSTRUMENTATION (otherwise AyumiAudioProcessor uses the generic editor directly).
 */
-class AyumiAudioProcessorEditor  : public juce::AudioProcessorEditor
+class AyumiAudioProcessorEditor  : public juce::AudioProcessorEditor, private juce::Timer
 {
 public:
     AyumiAudioProcessorEditor (AyumiAudioProcessor&);
@@ -29,5 +31,14 @@ private:
     // access the processor object that created it.
     AyumiAudioProcessor& audioProcessor;
     std::unique_ptr<juce::Drawable> svgimg;
+    juce::GenericAudioProcessorEditor parameters;
+   #if AYUMI_JUCE_INSTRUMENTATION
+    juce::TextEditor statsView;
+    juce::TextButton dumpButton{"Dump"};
+    juce::TextButton resetButton{"Reset"};
+   #endif
+
+    void timerCallback() override;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AyumiAudioProcessorEditor)
 };
@@ -26,6 +26,30 @@
 #define AYUMI_LV2_MIDI_CC_SOFTENV_STOP_5_VRATE_INDEX 0x2C
 #define AYUMI_LV2_MIDI_CC_DC 0x50
 
+// MIDI 2.0 UMP NRPNs (bank 0). Values are 32-bit, so each of them replaces a group of MIDI 1.0 CCs.
+#define AYUMI_UMP_NRPN_ENVELOPE 0x10 // upper 16 bits: envelope period
+#define AYUMI_UMP_NRPN_ENVELOPE_SHAPE 0x13 // upper 4 bits: envelope shape
+#define AYUMI_UMP_NRPN_TONE 0x14 // upper 12 bits: tone period (until next note on)
+#define AYUMI_UMP_NRPN_SOFTENV_NUM_POINTS 0x20 // upper 3 bits: number of stops (0-6)
+#define AYUMI_UMP_NRPN_SOFTENV_POINT_0 0x21 // upper 16 bits: stop at (msec.), lower 16 bits: volume ratio
+// ...(contd, every 2 indices)...
+#define AYUMI_UMP_NRPN_SOFTENV_POINT_5 0x2B
+
+// SysEx: F0 7D 41 <command> <payload> F7 (7Dh = non-commercial manufacturer ID)
+#define AYUMI_SYSEX_MANUFACTURER_ID 0x7D
+#define AYUMI_SYSEX_DEVICE_ID 0x41
+#define AYUMI_SYSEX_REGISTER_FRAME 0x01 // payload: R0-R13 in 7-bit packed form (16 bytes)
+#define AYUMI_SYSEX_CHANNEL_PATCH 0x02 // payload: channel, mixer, volume, pan, num stops, 6 * (at, ratio) in 14-bit MSB first
+#define AYUMI_SYSEX_REGISTER_FRAME_SIZE (3 + 16)
+#define AYUMI_SYSEX_CHANNEL_PATCH_SIZE (3 + 5 + 6 * 4)
+
+#define AYUMI_SNAPSHOT_MAGIC_NUMBER 0x4E534141 // "AASN"
+#define AYUMI_SNAPSHOT_VERSION 2
+
+// MIDI channel 16 selects presets from the preset bank (Bank Select MSB/LSB, then Program Change).
+#define AYUMI_PRESET_MIDI_CHANNEL 15
+#define AYUMI_HOST_REPORT_INTERVAL_MS 100 // how often changes on the audio thread (program switches, the quality tier) are reported to the host
+
 #define AYUMI_PARAMETER_MIXER_0_INDEX 0
 #define AYUMI_PARAMETER_MIXER_1_INDEX 1
 #define AYUMI_PARAMETER_MIXER_2_INDEX 2
@@ -51,16 +75,69 @@
 #define AYUMI_PARAMETER_SOFTENV_2_POINT_0_CLOCK 40
 #define AYUMI_PARAMETER_SOFTENV_2_POINT_0_RATIO 41
 #define AYUMI_PARAMETER_SOFTENV_2_POINT_5_RATIO 51 // end
-#define AYUMI_NUM_PARAMETERS 52
+#define AYUMI_PARAMETER_QUALITY_TIER_INDEX 52 // read-only, not saved in the state
+#define AYUMI_PARAMETER_LOW_LATENCY_INDEX 53 // not automatable, saved at the end of the state
+#define AYUMI_NUM_STATE_PARAMETERS 52
+#define AYUMI_NUM_PARAMETERS 54
+
+// CPU budget governor
+#define AYUMI_GOVERNOR_SMOOTHING 0.2 // weight of the latest block in the smoothed load
+#define AYUMI_GOVERNOR_STEP_DOWN_SECONDS 0.25 // sustained overload before stepping down
+#define AYUMI_GOVERNOR_STEP_UP_SECONDS 2.0 // sustained headroom before stepping up
+#define AYUMI_GOVERNOR_STEP_UP_RATIO 0.4 // headroom: load below budget * this
 
 //==============================================================================
 
+// A parameter that reports processor state to the host; it is not automatable, and changes from outside are ignored.
+class ReadOnlyParameter : public juce::AudioParameterFloat
+{
+public:
+    using juce::AudioParameterFloat::AudioParameterFloat;
+    bool isAutomatable() const override { return false; }
+};
+
+// A setting that is saved with the project but not automatable, as it takes effect at the next prepareToPlay().
+class SetupParameter : public juce::AudioParameterBool
+{
+public:
+    using juce::AudioParameterBool::AudioParameterBool;
+    bool isAutomatable() const override { return false; }
+};
+
 juce::AudioParameterFloat* createParameter(juce::String nameBase, int i, juce::NormalisableRange<float>& range, float def)
 {
     auto name = juce::String::formatted("%s %d", nameBase.toRawUTF8(), i);
     return new juce::AudioParameterFloat(name, name, range, def);
 }
 
+// Parameter index -> state field, range and engine apply function, in the order of addParameter() calls.
+#define AYUMI_CHANNEL_PARAMETERS(field, range, apply) \
+    {ParameterField::field, 0, 0, &AyumiAudioProcessor::range, apply}, \
+    {ParameterField::field, 1, 0, &AyumiAudioProcessor::range, apply}, \
+    {ParameterField::field, 2, 0, &AyumiAudioProcessor::range, apply}
+#define AYUMI_SOFTENV_STOP_PARAMETERS(ch, stop) \
+    {ParameterField::SoftEnvStopAt, ch, stop, &AyumiAudioProcessor::softwareEnvelopeStopSecondsRange, nullptr}, \
+    {ParameterField::SoftEnvStopRatio, ch, stop, &AyumiAudioProcessor::softwareEnvelopeStopRatioRange, nullptr}
+#define AYUMI_SOFTENV_PARAMETERS(ch) \
+    {ParameterField::SoftEnvNumStops, ch, 0, &AyumiAudioProcessor::softwareEnvelopeNumStopsRange, nullptr}, \
+    AYUMI_SOFTENV_STOP_PARAMETERS(ch, 0), AYUMI_SOFTENV_STOP_PARAMETERS(ch, 1), AYUMI_SOFTENV_STOP_PARAMETERS(ch, 2), \
+    AYUMI_SOFTENV_STOP_PARAMETERS(ch, 3), AYUMI_SOFTENV_STOP_PARAMETERS(ch, 4), AYUMI_SOFTENV_STOP_PARAMETERS(ch, 5)
+
+constexpr AyumiAudioProcessor::ParameterDescriptor AyumiAudioProcessor::parameterDescriptors[] = {
+    AYUMI_CHANNEL_PARAMETERS(Mixer, mixerRange, nullptr), // applied at note on
+    AYUMI_CHANNEL_PARAMETERS(Volume, volumeRange, &AyumiAudioProcessor::applyVolume),
+    AYUMI_CHANNEL_PARAMETERS(Pan, panRange, &AyumiAudioProcessor::applyPan),
+    {ParameterField::Envelope, 0, 0, &AyumiAudioProcessor::envelopeRange, &AyumiAudioProcessor::applyEnvelope},
+    {ParameterField::EnvelopeShape, 0, 0, &AyumiAudioProcessor::envelopeShapeRange, &AyumiAudioProcessor::applyEnvelopeShape},
+    {ParameterField::Noise, 0, 0, &AyumiAudioProcessor::noiseFreqRange, &AyumiAudioProcessor::applyNoise},
+    {ParameterField::Clock, 0, 0, &AyumiAudioProcessor::clockRange, &AyumiAudioProcessor::applyClock}, // "<reserved>" so far
+    AYUMI_SOFTENV_PARAMETERS(0), // read from the state while processing
+    AYUMI_SOFTENV_PARAMETERS(1),
+    AYUMI_SOFTENV_PARAMETERS(2),
+    {ParameterField::ReadOnly, 0, 0, &AyumiAudioProcessor::qualityTierRange, nullptr},
+    {ParameterField::LowLatency, 0, 0, &AyumiAudioProcessor::lowLatencyRange, nullptr}, // applied at prepareToPlay()
+};
+
 AyumiAudioProcessor::AyumiAudioProcessor()
 #ifndef JucePlugin_PreferredChannelConfigurations
      : AudioProcessor (BusesProperties()
@@ -69,6 +146,10 @@ AyumiAudioProcessor::AyumiAudioProcessor()
                        .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
                       #endif
                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
+                       // optional per-PSG-channel outputs (stems), rendered in the same pass as the mix.
+                       .withOutput ("Channel A", juce::AudioChannelSet::stereo(), false)
+                       .withOutput ("Channel B", juce::AudioChannelSet::stereo(), false)
+                       .withOutput ("Channel C", juce::AudioChannelSet::stereo(), false)
                      #endif
                        )
 #endif
@@ -100,10 +181,37 @@ AyumiAudioProcessor::AyumiAudioProcessor()
         }
     }
 
+    addParameter(new ReadOnlyParameter("QualityTier", "QualityTier", qualityTierRange, (float) AYUMI_QUALITY_FULL));
+    addParameter(new SetupParameter("LowLatency", "LowLatency", false));
+
+    static_assert(sizeof(parameterDescriptors) / sizeof(parameterDescriptors[0]) == AYUMI_NUM_PARAMETERS,
+                  "every parameter needs a descriptor");
+    static_assert(parameterDescriptors[AYUMI_PARAMETER_SOFTENV_2_POINT_0_CLOCK].field == ParameterField::SoftEnvStopAt
+                  && parameterDescriptors[AYUMI_PARAMETER_SOFTENV_2_POINT_5_RATIO].channel == 2
+                  && parameterDescriptors[AYUMI_PARAMETER_SOFTENV_2_POINT_5_RATIO].stop == 5
+                  && parameterDescriptors[AYUMI_PARAMETER_QUALITY_TIER_INDEX].field == ParameterField::ReadOnly
+                  && parameterDescriptors[AYUMI_PARAMETER_LOW_LATENCY_INDEX].field == ParameterField::LowLatency,
+                  "the descriptors must follow the parameter indices");
+    static_assert(AYUMI_NUM_PARAMETERS <= 64, "dirtyParameters has a bit per parameter");
+    static_assert(AYUMI_NUM_PARAMETERS <= sizeof(changedParameterValues) / sizeof(changedParameterValues[0]),
+                  "changedParameterValues has a value per parameter");
     addListener(this);
+    startTimer(AYUMI_HOST_REPORT_INTERVAL_MS);
+
+    auto presetBankPath = juce::SystemStats::getEnvironmentVariable("AYUMI_JUCE_PRESET_BANK", {});
+    juce::String error;
+    if (presetBankPath.isNotEmpty() && !loadPresetBank(juce::File{presetBankPath}, error))
+        DBG(error);
 }
 
-AyumiAudioProcessor::~AyumiAudioProcessor() = default;
+AyumiAudioProcessor::~AyumiAudioProcessor()
+{
+    stopTimer();
+    stopRegisterCapture();
+   #if AYUMI_JUCE_TRACING
+    trace.stop();
+   #endif
+}
 
 //==============================================================================
 const juce::String AyumiAudioProcessor::getName() const
@@ -143,73 +251,300 @@ double AyumiAudioProcessor::getTailLengthSeconds() const
     return 0.0;
 }
 
+// The preset bank is replaced only on the message thread, like these are called; the lock is for the audio thread.
 int AyumiAudioProcessor::getNumPrograms()
 {
-    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
+    return std::max(1, presetBank.getNumPresets());   // NB: some hosts don't cope very well if you tell them there are 0 programs,
                 // so this should be at least 1, even if you're not really implementing programs.
 }
 
 int AyumiAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return currentProgram;
 }
 
 void AyumiAudioProcessor::setCurrentProgram (int index)
 {
+    // switched at the next block (or the first one after prepareToPlay()). Hosts also set the current program
+    // again when they restore a project, which must not override the restored state.
+    if (index != currentProgram)
+        pendingProgram = index;
 }
 
 const juce::String AyumiAudioProcessor::getProgramName (int index)
 {
-    return {};
+    if (index < 0 || index >= presetBank.getNumPresets())
+        return {};
+    return juce::String::fromUTF8(presetBank.getName(index));
 }
 
 void AyumiAudioProcessor::changeProgramName (int index, const juce::String& newName)
 {
+    // the preset bank is read-only.
 }
 
-void AyumiAudioProcessor::setParametersFromState() {
-    auto pl = getParameterTree().getParameters(false);
-    for (int i = 0; i < 3; i++) {
-        pl[AYUMI_PARAMETER_MIXER_0_INDEX + i]->setValue(mixerRange.convertTo0to1(ayumi.state.mixer[i]));
-        pl[AYUMI_PARAMETER_VOLUME_0_INDEX + i]->setValue(volumeRange.convertTo0to1(ayumi.state.volume[i]));
-        pl[AYUMI_PARAMETER_PAN_0_INDEX + i]->setValue(panRange.convertTo0to1(ayumi.state.pan[i]));
-    }
-    pl[AYUMI_PARAMETER_ENVELOPE_INDEX]->setValue(envelopeRange.convertTo0to1(ayumi.state.envelope));
-    pl[AYUMI_PARAMETER_ENVELOPE_SHAPE_INDEX]->setValue(envelopeShapeRange.convertTo0to1(ayumi.state.envelope_shape));
-    pl[AYUMI_PARAMETER_NOISE_INDEX]->setValue(noiseFreqRange.convertTo0to1(ayumi.state.noise_freq));
-    pl[AYUMI_PARAMETER_CLOCK_RATE_INDEX]->setValue(clockRange.convertTo0to1(ayumi.state.clock_rate));
-    for (int i = 0; i < 3; i++) {
-        pl[AYUMI_PARAMETER_SOFTENV_0_NUM_POINTS + i * 13]->setValue(
-                softwareEnvelopeNumStopsRange.convertTo0to1(ayumi.state.softenv_form[i].num_points));
-        for (int p = 0; p < 6; p++) {
-            pl[AYUMI_PARAMETER_SOFTENV_0_POINT_0_CLOCK + i * 13 + p * 2]->setValue(
-                    softwareEnvelopeStopSecondsRange.convertTo0to1(ayumi.state.softenv_form[i].stops[p].stopAt));
-            pl[AYUMI_PARAMETER_SOFTENV_0_POINT_0_RATIO + i * 13 + p * 2]->setValue(
-                    softwareEnvelopeStopRatioRange.convertTo0to1(ayumi.state.softenv_form[i].stops[p].volumeRatio));
+// Through the parameter, so that the host sees the change; the listener stores it into lowLatencyEnabled.
+void AyumiAudioProcessor::setLowLatencyEnabled (bool enabled)
+{
+    getParameters()[AYUMI_PARAMETER_LOW_LATENCY_INDEX]->setValueNotifyingHost(enabled ? 1.0f : 0.0f);
+}
+
+// Brings the parameter values in line with the state in one pass. setValue() does not notify the listeners, so
+// nothing is applied to the engine a parameter at a time; that is done once by applyStateToEngine().
+void AyumiAudioProcessor::setParametersFromState(const AyumiState& state) {
+    auto& pl = getParameters(); // no copy, as it is also called on the audio thread
+
+    for (int i = 0; i < AYUMI_NUM_PARAMETERS; i++) {
+        auto& d = parameterDescriptors[i];
+        if (d.field != ParameterField::ReadOnly)
+            pl[i]->setValue((this->*d.range).convertTo0to1(getStateValue(state, d)));
+    }
+}
+
+float AyumiAudioProcessor::getStateValue(const AyumiState& s, const ParameterDescriptor& d) const {
+    switch (d.field) {
+        case ParameterField::Mixer: return (float) s.mixer[d.channel];
+        case ParameterField::Volume: return (float) s.volume[d.channel];
+        case ParameterField::Pan: return s.pan[d.channel];
+        case ParameterField::Envelope: return (float) s.envelope;
+        case ParameterField::EnvelopeShape: return (float) s.envelope_shape;
+        case ParameterField::Noise: return (float) s.noise_freq;
+        case ParameterField::Clock: return (float) s.clock_rate;
+        case ParameterField::SoftEnvNumStops: return (float) s.softenv_form[d.channel].num_points;
+        case ParameterField::SoftEnvStopAt: return s.softenv_form[d.channel].stops[d.stop].stopAt;
+        case ParameterField::SoftEnvStopRatio: return s.softenv_form[d.channel].stops[d.stop].volumeRatio;
+        case ParameterField::LowLatency: return lowLatencyEnabled ? 1.0f : 0.0f; // a processor setting
+        case ParameterField::ReadOnly: break;
+    }
+    return 0;
+}
+
+// Stores a plain parameter value into its state field. Returns false if the field did not change.
+bool AyumiAudioProcessor::setStateValue(AyumiState& s, const ParameterDescriptor& d, float value) {
+    auto store = [](auto& field, auto newValue) {
+        if (field == newValue)
+            return false;
+        field = newValue;
+        return true;
+    };
+    switch (d.field) {
+        case ParameterField::Mixer: return store(s.mixer[d.channel], (int) value);
+        case ParameterField::Volume: return store(s.volume[d.channel], (int) value);
+        case ParameterField::Pan: return store(s.pan[d.channel], value);
+        case ParameterField::Envelope: return store(s.envelope, (int32_t) value);
+        case ParameterField::EnvelopeShape: return store(s.envelope_shape, (int32_t) value);
+        case ParameterField::Noise: return store(s.noise_freq, (int32_t) value);
+        case ParameterField::Clock: return store(s.clock_rate, (int32_t) value);
+        case ParameterField::SoftEnvNumStops: return store(s.softenv_form[d.channel].num_points, (uint8_t) value);
+        case ParameterField::SoftEnvStopAt: return store(s.softenv_form[d.channel].stops[d.stop].stopAt, value);
+        case ParameterField::SoftEnvStopRatio: return store(s.softenv_form[d.channel].stops[d.stop].volumeRatio, value);
+        case ParameterField::LowLatency: // set by the listener right away
+        case ParameterField::ReadOnly: break;
+    }
+    return false;
+}
+
+// Engine side of the parameters, on the audio thread (applyPendingChanges()). They read the state.
+void AyumiAudioProcessor::applyVolume(const ParameterDescriptor& d) {
+    ayumi_set_volume(&ayumi.impl, d.channel, ayumi.state.volume[d.channel]);
+}
+
+void AyumiAudioProcessor::applyPan(const ParameterDescriptor& d) {
+    ayumi_set_pan(&ayumi.impl, d.channel, ayumi.state.pan[d.channel], false);
+}
+
+void AyumiAudioProcessor::applyEnvelope(const ParameterDescriptor&) {
+    ayumi_set_envelope(&ayumi.impl, ayumi.state.envelope);
+}
+
+void AyumiAudioProcessor::applyEnvelopeShape(const ParameterDescriptor&) {
+    ayumi_restart_envelope(ayumi.state.envelope_shape);
+}
+
+void AyumiAudioProcessor::applyNoise(const ParameterDescriptor&) {
+    ayumi_set_noise(&ayumi.impl, ayumi.state.noise_freq);
+}
+
+void AyumiAudioProcessor::applyClock(const ParameterDescriptor&) {
+    ayumi_reconfigure(&ayumi.impl, ayumi.stems.get(), 1, ayumi.state.clock_rate, ayumi.sample_rate);
+}
+
+// Audio thread: applies a state loaded during playback, a host program change and the parameters changed since
+// the last block to the engine, once each however many change notifications there were.
+void AyumiAudioProcessor::applyPendingChanges() {
+    if (stateChanged) {
+        // if the message thread holds the lock, the state is taken at the next block.
+        const juce::SpinLock::ScopedTryLockType lock{stateLock};
+        if (lock.isLocked() && stateChanged.exchange(false)) {
+            ayumi.state = pendingState;
+            applyStateToEngine();
         }
     }
+    auto program = pendingProgram.exchange(-1);
+    if (program >= 0)
+        applyPreset(program);
+    if (dirtyParameters.load(std::memory_order_relaxed) != 0) {
+        // parameter changes made after a loaded state are applied on top of it; the lock keeps the two in order.
+        const juce::SpinLock::ScopedTryLockType lock{stateLock};
+        if (!lock.isLocked())
+            return;
+        auto changed = storeChangedParameters(ayumi.state, dirtyParameters.exchange(0));
+        for (int i = 0; changed != 0; i++, changed >>= 1)
+            if ((changed & 1) && parameterDescriptors[i].apply != nullptr)
+                (this->*parameterDescriptors[i].apply)(parameterDescriptors[i]);
+    }
 }
 
-//==============================================================================
-void AyumiAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
-{
-    if (ayumi.state.magic_number != AYUMI_JUCE_STATE_MAGIC_NUMBER)
-        ayumi.reset();
+// Stores the latest values of the `dirty` parameters into `state`. Returns the bits of the fields that changed.
+uint64_t AyumiAudioProcessor::storeChangedParameters(AyumiState& state, uint64_t dirty) {
+    uint64_t changed = 0;
+    for (int i = 0; dirty != 0; i++, dirty >>= 1)
+        if ((dirty & 1) && setStateValue(state, parameterDescriptors[i], changedParameterValues[i].load()))
+            changed |= (uint64_t) 1 << i;
+    return changed;
+}
 
-    setParametersFromState();
+// Message thread: the current state, including a loaded state and parameter changes the audio thread has not
+// taken yet (it may not be running at all).
+AyumiAudioProcessor::AyumiState AyumiAudioProcessor::copyState() {
+    const juce::SpinLock::ScopedLockType lock{stateLock};
+    AyumiState state = stateChanged ? pendingState : ayumi.state;
+    storeChangedParameters(state, dirtyParameters.load());
+    return state;
+}
 
-    ayumi.active = false;
-    ayumi.sample_rate = (int) sampleRate;
-    ayumi_configure(&ayumi.impl, 1, ayumi.state.clock_rate, ayumi.sample_rate);
+// Configures the engine from the whole state at once: at prepareToPlay(), and on the audio thread after a state
+// is loaded during playback.
+void AyumiAudioProcessor::applyStateToEngine() {
+    if (ayumi.configured)
+        // sample rate (or clock) changes keep the chip and filter state, so that nothing clicks. The envelope
+        // shape is applied at the next note on.
+        ayumi_reconfigure(&ayumi.impl, ayumi.stems.get(), 1, ayumi.state.clock_rate, ayumi.sample_rate);
+    else {
+        ayumi_configure(&ayumi.impl, 1, ayumi.state.clock_rate, ayumi.sample_rate);
+        for (int i = 0; i < 3; i++)
+            ayumi_set_mixer(&ayumi.impl, i, 1, 1, 0); // should be quiet by default
+        ayumi_set_envelope_shape(&ayumi.impl, ayumi.state.envelope_shape);
+        ayumi.configured = true;
+    }
     ayumi_set_noise(&ayumi.impl, ayumi.state.noise_freq); // pink noise by default
 
 	for (int i = 0; i < 3; i++) {
 		ayumi_set_pan(&ayumi.impl, i, ayumi.state.pan[i], 0); // 0(L)...1(R)
-		ayumi_set_mixer(&ayumi.impl, i, 1, 1, 0); // should be quiet by default
 		ayumi_set_volume(&ayumi.impl, i, ayumi.state.volume[i]);
 	}
-    ayumi_set_envelope_shape(&ayumi.impl, ayumi.state.envelope_shape);
     ayumi_set_envelope(&ayumi.impl, ayumi.state.envelope);
+}
+
+// Audio thread: switches to preset `index`. The record is copied over the state as it is (a fixed-size copy, without
+// allocation or parsing), then the engine and the parameters follow; the host is told from timerCallback().
+void AyumiAudioProcessor::applyPreset(int index) {
+    const juce::SpinLock::ScopedTryLockType lock{presetBankLock};
+    const juce::SpinLock::ScopedTryLockType lockState{stateLock};
+    if (!lock.isLocked() || !lockState.isLocked()) {
+        // the bank is being replaced, or the state copied, right now: tried again at the next block.
+        int none = -1;
+        pendingProgram.compare_exchange_strong(none, index);
+        return;
+    }
+    if (index < 0 || index >= presetBank.getNumPresets())
+        return;
+    memcpy(&ayumi.state, presetBank.getState(index), sizeof(AyumiState));
+    ayumi.state.magic_number = AYUMI_JUCE_STATE_MAGIC_NUMBER;
+    dirtyParameters = 0; // the preset replaces the earlier changes
+    applyStateToEngine();
+    setParametersFromState(ayumi.state);
+    currentProgram = index;
+    programChanged = true;
+}
+
+void AyumiAudioProcessor::timerCallback()
+{
+    if (programChanged.exchange(false))
+        updateHostDisplay(ChangeDetails{}.withProgramChanged(true).withParameterInfoChanged(true));
+    // the audio thread only publishes the tier (updateGovernor()); notifying the host calls back into it.
+    auto tierParameter = getParameters()[AYUMI_PARAMETER_QUALITY_TIER_INDEX];
+    auto tier = qualityTierRange.convertTo0to1((float) qualityTier.load());
+    if (tierParameter->getValue() != tier)
+        tierParameter->setValueNotifyingHost(tier);
+}
+
+//==============================================================================
+void AyumiAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
+{
+    {
+        // a loaded state, and the parameter changes made while not playing, are all configured below.
+        const juce::SpinLock::ScopedLockType lock{stateLock};
+        if (stateChanged.exchange(false))
+            ayumi.state = pendingState;
+        storeChangedParameters(ayumi.state, dirtyParameters.exchange(0));
+    }
+    // a loaded state has already updated the parameters (setStateInformation()).
+    if (ayumi.state.magic_number != AYUMI_JUCE_STATE_MAGIC_NUMBER) {
+        ayumi.reset();
+        setParametersFromState(ayumi.state);
+    }
+
+    ayumi.active = false;
+    ayumi.sample_rate = (int) sampleRate;
+    applyStateToEngine();
+    {
+        // a register log has its own clock, and needs the new sample rate. They are applied on the audio thread.
+        const juce::SpinLock::ScopedLockType lock{registerLogLock};
+        ayumi.register_log_changed |= registerLog.isOpen();
+    }
+
+    auto captureDir = juce::SystemStats::getEnvironmentVariable("AYUMI_JUCE_CAPTURE_DIR", {});
+    if (captureDir.isNotEmpty() && registerCapture == nullptr) {
+        juce::String error;
+        auto name = "ayumi-capture-" + juce::Time::getCurrentTime().formatted("%Y%m%d-%H%M%S")
+                    + "-" + juce::String::toHexString((juce::pointer_sized_int) this) + ".vgm";
+        if (!startRegisterCapture(juce::File{captureDir}.getChildFile(name), error))
+            DBG(error);
+    }
+   #if AYUMI_JUCE_TRACING
+    auto traceDir = juce::SystemStats::getEnvironmentVariable("AYUMI_JUCE_TRACE_DIR", {});
+    if (traceDir.isNotEmpty() && !trace.isRecording()) {
+        juce::String error;
+        auto name = "ayumi-trace-" + juce::Time::getCurrentTime().formatted("%Y%m%d-%H%M%S")
+                    + "-" + juce::String::toHexString((juce::pointer_sized_int) this) + ".json";
+        if (!startTrace(juce::File{traceDir}.getChildFile(name), error))
+            DBG(error);
+    }
+   #endif
+
+    // per-channel stems are allocated only when any of the channel buses is enabled.
+    bool stemsEnabled = false;
+    for (int i = 0; i < TONE_CHANNELS; i++) {
+        auto bus = getBus(false, 1 + i);
+        stemsEnabled |= bus != nullptr && bus->isEnabled();
+    }
+    if (stemsEnabled)
+        ayumi.stems.reset(new struct ayumi_stem[TONE_CHANNELS]());
+    else
+        ayumi.stems.reset();
+
+    bool lowLatency = lowLatencyEnabled
+                      || juce::SystemStats::getEnvironmentVariable("AYUMI_JUCE_LOW_LATENCY", {}) == "1";
+    ayumi_set_low_latency(&ayumi.impl, lowLatency);
+
+    // the tone cache approximates the emulation, so it is used only on request. It assumes linear-phase filters.
+    if (!lowLatency
+        && (toneCacheEnabled || juce::SystemStats::getEnvironmentVariable("AYUMI_JUCE_TONE_CACHE", {}) == "1")) {
+        ayumi.tone_cache.reset(new struct ayumi_tone_cache());
+        ayumi_tone_cache_init(ayumi.tone_cache.get());
+    } else
+        ayumi.tone_cache.reset();
+
+    // the governor starts over from full quality.
+    ayumi_set_quality(&ayumi.impl, ayumi.stems.get(), AYUMI_QUALITY_FULL);
+    qualityTier = AYUMI_QUALITY_FULL;
+    governorLoad = governorOverSeconds = governorUnderSeconds = 0;
+
+    // the delay of the filters at full quality, for plugin delay compensation (the lower tiers of the
+    // low-latency mode are up to a frame earlier, which is not worth a latency change in the middle of playback).
+    setLatencySamples(juce::roundToInt(ayumi_latency(&ayumi.impl)));
+
     ayumi.active = true;
 }
 
@@ -231,6 +566,13 @@ bool AyumiAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) co
      && layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
         return false;
 
+    // Per-channel outputs can be either disabled, mono or stereo.
+    for (int i = 1; i < layouts.outputBuses.size(); i++) {
+        auto set = layouts.getChannelSet(false, i);
+        if (!set.isDisabled() && set != juce::AudioChannelSet::mono() && set != juce::AudioChannelSet::stereo())
+            return false;
+    }
+
     // This checks if the input layout matches the output layout
    #if ! JucePlugin_IsSynth
     if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
@@ -249,11 +591,22 @@ double key_to_freq(double key) {
     return ret;
 }
 
-void AyumiAudioProcessor::ayumi_process_midi_event(juce::MidiMessage &msg) {
+void AyumiAudioProcessor::ayumi_process_midi_event(const uint8_t* bytes, int size) {
+    AYUMI_TRACE_SCOPE(trace, "ayumi_process_midi_event", "status", size > 0 ? bytes[0] : -1, "data1", size > 1 ? bytes[1] : -1);
     AyumiContext *a = &ayumi;
 	int noise, tone_switch, noise_switch, env_switch;
-	uint8_t * bytes = (uint8_t*) msg.getRawData();
+	if (size > 0 && bytes[0] == 0xF0) {
+		ayumi_process_sysex(bytes + 1, bytes[size - 1] == 0xF7 ? size - 2 : size - 1);
+		return;
+	}
+	// We do not handle running status or system messages. Program change is the only 2-byte message we process.
+	if (size < 2 || (size < 3 && (bytes[0] & 0xF0) != CMIDI2_STATUS_PROGRAM))
+		return;
 	int channel = bytes[0] & 0xF;
+	if (channel == AYUMI_PRESET_MIDI_CHANNEL) {
+		ayumi_process_preset_event(bytes);
+		return;
+	}
 	if (channel > 2)
 		return;
 	int mixer;
@@ -266,7 +619,7 @@ void AyumiAudioProcessor::ayumi_process_midi_event(juce::MidiMessage &msg) {
 		ayumi_set_mixer(&a->impl, channel, 1, 1, 0);
 		// It is kinda hacky, but we "reset" envelope shape to "different value" so that every note can start the envelope waveform
 		// FIXME: should we add another plugin parameter to control whether or not we reset envelope for each note off?
-		ayumi_set_envelope_shape(&a->impl, (ayumi.state.envelope_shape + 1) % 16);
+		ayumi_restart_envelope((ayumi.state.envelope_shape + 1) % 16);
 		a->note_on_state[channel] = false;
 		break;
 	case CMIDI2_STATUS_NOTE_ON:
@@ -279,7 +632,7 @@ void AyumiAudioProcessor::ayumi_process_midi_event(juce::MidiMessage &msg) {
 		noise_switch = mixer & 2 ? 1 : 0;
 		env_switch = mixer & 4 ? 1 : 0;
 		ayumi_set_mixer(&a->impl, channel, tone_switch, noise_switch, env_switch);
-		ayumi_set_envelope_shape(&a->impl, a->state.envelope_shape);
+		ayumi_restart_envelope(a->state.envelope_shape);
         a->softenv[channel].started_at = a->totalProcessRunSeconds;
 		keyWithPitchbend = (float) bytes[1] + (float) a->pitchbend[channel] / 8192 * a->pitchbend_sensitivity;
 
@@ -293,6 +646,7 @@ void AyumiAudioProcessor::ayumi_process_midi_event(juce::MidiMessage &msg) {
 			ayumi_set_tone(&a->impl, channel, (int) reg);
         }
 		a->note_on_state[channel] = true;
+		AYUMI_TRACE_INSTANT(trace, "note on", "channel", channel, "key", bytes[1]);
 		break;
 	case CMIDI2_STATUS_PROGRAM:
 		noise = bytes[1] & 0x1F;
@@ -337,7 +691,7 @@ void AyumiAudioProcessor::ayumi_process_midi_event(juce::MidiMessage &msg) {
 			ayumi_set_envelope(&a->impl, a->state.envelope);
 			break;
 		case AYUMI_LV2_MIDI_CC_ENVELOPE_SHAPE:
-			ayumi_set_envelope_shape(&a->impl, bytes[2] & 0xF);
+			ayumi_restart_envelope(bytes[2] & 0xF);
 			break;
 		case AYUMI_LV2_MIDI_CC_DC:
 			ayumi_remove_dc(&a->impl);
@@ -367,13 +721,352 @@ void AyumiAudioProcessor::ayumi_process_midi_event(juce::MidiMessage &msg) {
 	}
 }
 
+// Writes a single AY register. The last written values are kept, as the mixer (R7) and the envelope switches
+// (R8-R10) are combined into one ayumi mixer setting, and tone periods are split into two registers.
+void AyumiAudioProcessor::ayumi_write_register(int reg, uint8_t value) {
+    AyumiContext *a = &ayumi;
+    uint8_t* r = a->registers;
+    r[reg] = value;
+    auto setMixer = [a, r](int ch) {
+        int tone_off = (r[7] >> ch) & 1;
+        int noise_off = (r[7] >> (ch + 3)) & 1;
+        int env_on = (r[8 + ch] >> 4) & 1;
+        a->state.mixer[ch] = tone_off + (noise_off << 1) + (env_on << 2);
+        ayumi_set_mixer(&a->impl, ch, tone_off, noise_off, env_on);
+    };
+    switch (reg) {
+    case 0: case 1: case 2: case 3: case 4: case 5:
+        ayumi_set_tone(&a->impl, reg / 2, r[reg / 2 * 2] + ((r[reg / 2 * 2 + 1] & 0xF) << 8));
+        break;
+    case 6:
+        a->state.noise_freq = value & 0x1F;
+        ayumi_set_noise(&a->impl, a->state.noise_freq);
+        break;
+    case 7:
+        for (int ch = 0; ch < 3; ch++)
+            setMixer(ch);
+        break;
+    case 8: case 9: case 10:
+        setMixer(reg - 8);
+        a->state.volume[reg - 8] = value & 0xF;
+        ayumi_set_volume(&a->impl, reg - 8, a->state.volume[reg - 8]);
+        break;
+    case 11: case 12:
+        a->state.envelope = r[11] + (r[12] << 8);
+        ayumi_set_envelope(&a->impl, a->state.envelope);
+        break;
+    case 13:
+        a->state.envelope_shape = value & 0xF;
+        ayumi_restart_envelope(a->state.envelope_shape);
+        break;
+    default:
+        return;
+    }
+    // the chip is now driven by registers, so it has to be rendered even without notes.
+    a->registers_active = true;
+}
+
+// Preset selection on AYUMI_PRESET_MIDI_CHANNEL: Bank Select MSB/LSB, then Program Change.
+void AyumiAudioProcessor::ayumi_process_preset_event(const uint8_t* bytes) {
+    AyumiContext *a = &ayumi;
+    switch (bytes[0] & 0xF0) {
+    case CMIDI2_STATUS_CC:
+        if (bytes[1] == CMIDI2_CC_BANK_SELECT)
+            a->preset_bank_select = (bytes[2] << 7) + (a->preset_bank_select & 0x7F);
+        else if (bytes[1] == CMIDI2_CC_BANK_SELECT_LSB)
+            a->preset_bank_select = (a->preset_bank_select & ~0x7F) + bytes[2];
+        break;
+    case CMIDI2_STATUS_PROGRAM:
+        applyPreset(a->preset_bank_select * 128 + bytes[1]);
+        break;
+    }
+}
+
+// Applies an entire AY register frame (R0-R13) at once. R13 = FFh means "do not write" (no envelope restart),
+// as in YM files.
+void AyumiAudioProcessor::ayumi_apply_registers(const uint8_t* r) {
+    for (int i = 0; i < 13; i++)
+        ayumi_write_register(i, r[i]);
+    if (r[13] != 0xFF)
+        ayumi_write_register(13, r[13]);
+}
+
+void AyumiAudioProcessor::ayumi_restart_envelope(int shape) {
+    ayumi_set_envelope_shape(&ayumi.impl, shape);
+    ayumi.envelope_restarted = true;
+}
+
+// Records the register changes (if capturing) at `frameInBlock` of the current block.
+void AyumiAudioProcessor::ayumi_capture_registers(int frameInBlock) {
+    if (ayumi.capture == nullptr)
+        return;
+    ayumi.capture->capture(frameInBlock, &ayumi.impl, ayumi.envelope_restarted);
+    ayumi.envelope_restarted = false;
+}
+
+// Applies the registers written by the register log player since the last call.
+void AyumiAudioProcessor::ayumi_apply_register_log() {
+    auto r = registerLog.getRegisters();
+    uint16_t written = registerLog.takeWrittenRegisters();
+    for (int i = 0; written != 0; i++, written >>= 1)
+        if (written & 1)
+            ayumi_write_register(i, r[i]);
+}
+
+// `data` does not contain F0 and F7.
+void AyumiAudioProcessor::ayumi_process_sysex(const uint8_t* data, int size) {
+    AyumiContext *a = &ayumi;
+    if (size < 3 || data[0] != AYUMI_SYSEX_MANUFACTURER_ID || data[1] != AYUMI_SYSEX_DEVICE_ID)
+        return;
+    const uint8_t* payload = data + 3;
+    switch (data[2]) {
+    case AYUMI_SYSEX_REGISTER_FRAME: {
+        if (size < AYUMI_SYSEX_REGISTER_FRAME_SIZE)
+            return;
+        // two groups of 7 registers, each group is an MSB byte followed by 7 lower-7-bit bytes.
+        uint8_t r[14];
+        for (int i = 0; i < 14; i++)
+            r[i] = payload[i / 7 * 8 + 1 + i % 7] + (((payload[i / 7 * 8] >> (i % 7)) & 1) << 7);
+        ayumi_apply_registers(r);
+        break;
+    }
+    case AYUMI_SYSEX_CHANNEL_PATCH: {
+        if (size < AYUMI_SYSEX_CHANNEL_PATCH_SIZE || payload[0] > 2)
+            return;
+        int ch = payload[0];
+        int mixer = payload[1] & 7;
+        a->state.mixer[ch] = mixer;
+        if (a->note_on_state[ch])
+            ayumi_set_mixer(&a->impl, ch, mixer & 1, (mixer >> 1) & 1, (mixer >> 2) & 1);
+        a->state.volume[ch] = payload[2] > 14 ? 14 : payload[2];
+        ayumi_set_volume(&a->impl, ch, a->state.volume[ch]);
+        a->state.pan[ch] = (float) payload[3] / 128.0f;
+        ayumi_set_pan(&a->impl, ch, a->state.pan[ch], 0);
+        auto &form = a->state.softenv_form[ch];
+        form.num_points = payload[4] > 6 ? 6 : payload[4];
+        for (int p = 0; p < 6; p++) {
+            auto stop = payload + 5 + p * 4;
+            form.stops[p].stopAt = (float) ((stop[0] << 7) + stop[1]) * 0.001f;
+            form.stops[p].volumeRatio = (float) ((stop[2] << 7) + stop[3]) / 16383.0f;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static int ump_size_in_ints(uint32_t word) {
+    switch (word >> 28) {
+    case CMIDI2_MESSAGE_TYPE_UTILITY:
+    case CMIDI2_MESSAGE_TYPE_SYSTEM:
+    case CMIDI2_MESSAGE_TYPE_MIDI_1_CHANNEL:
+    case 6:
+    case 7:
+        return 1;
+    case CMIDI2_MESSAGE_TYPE_SYSEX7:
+    case CMIDI2_MESSAGE_TYPE_MIDI_2_CHANNEL:
+    case 8:
+    case 9:
+    case 0xA:
+        return 2;
+    case 0xB:
+    case 0xC:
+        return 3;
+    default:
+        return 4;
+    }
+}
+
+void AyumiAudioProcessor::ayumi_process_ump_event(const uint32_t* ump) {
+    AyumiContext *a = &ayumi;
+    auto p = const_cast<cmidi2_ump*>(ump);
+    if (cmidi2_ump_get_group(p) != 0)
+        return;
+    int channel = cmidi2_ump_get_channel(p);
+    uint8_t bytes[3];
+    uint32_t data;
+
+    switch (cmidi2_ump_get_message_type(p)) {
+    case CMIDI2_MESSAGE_TYPE_SYSEX7: {
+        // assemble the SysEx packets into the preallocated buffer, then process it as a whole.
+        int status = cmidi2_ump_get_status_code(p);
+        if (status == CMIDI2_SYSEX_IN_ONE_UMP || status == CMIDI2_SYSEX_START)
+            a->sysex_size = 0;
+        for (int i = 0; i < cmidi2_ump_get_sysex7_num_bytes(p) && i < 6; i++)
+            if (a->sysex_size < (int) sizeof(a->sysex_buffer))
+                a->sysex_buffer[a->sysex_size++] = cmidi2_ump_get_byte_at(p, 2 + i);
+        if (status == CMIDI2_SYSEX_IN_ONE_UMP || status == CMIDI2_SYSEX_END)
+            ayumi_process_sysex(a->sysex_buffer, a->sysex_size);
+        break;
+    }
+    case CMIDI2_MESSAGE_TYPE_MIDI_1_CHANNEL:
+        bytes[0] = cmidi2_ump_get_byte_at(p, 1);
+        bytes[1] = cmidi2_ump_get_midi1_byte2(p);
+        bytes[2] = cmidi2_ump_get_midi1_byte3(p);
+        ayumi_process_midi_event(bytes, 3);
+        break;
+    case CMIDI2_MESSAGE_TYPE_MIDI_2_CHANNEL:
+        if (channel == AYUMI_PRESET_MIDI_CHANNEL && cmidi2_ump_get_status_code(p) == CMIDI2_STATUS_PROGRAM) {
+            // MIDI 2.0 program changes carry the bank (if the "bank valid" option bit is set).
+            if (cmidi2_ump_get_midi2_program_options(p) & 1)
+                a->preset_bank_select = (cmidi2_ump_get_midi2_program_bank_msb(p) << 7)
+                                        + cmidi2_ump_get_midi2_program_bank_lsb(p);
+            bytes[0] = CMIDI2_STATUS_PROGRAM + channel;
+            bytes[1] = cmidi2_ump_get_midi2_program_program(p);
+            bytes[2] = 0;
+            ayumi_process_midi_event(bytes, 3);
+            break;
+        }
+        if (channel > 2)
+            return;
+        bytes[0] = cmidi2_ump_get_status_code(p) + channel;
+        switch (cmidi2_ump_get_status_code(p)) {
+        case CMIDI2_STATUS_NOTE_OFF:
+        case CMIDI2_STATUS_NOTE_ON:
+            // MIDI 2.0 note on with velocity 0 is still a note on.
+            bytes[1] = cmidi2_ump_get_midi2_note_note(p);
+            bytes[2] = (uint8_t) std::max(1, cmidi2_ump_get_midi2_note_velocity(p) >> 9);
+            ayumi_process_midi_event(bytes, 3);
+            break;
+        case CMIDI2_STATUS_PROGRAM:
+            bytes[1] = cmidi2_ump_get_midi2_program_program(p);
+            bytes[2] = 0;
+            ayumi_process_midi_event(bytes, 3);
+            break;
+        case CMIDI2_STATUS_PITCH_BEND:
+        case CMIDI2_STATUS_PER_NOTE_PITCH_BEND:
+            // every channel is monophonic, so per-note pitch bend is the same as channel pitch bend.
+            data = cmidi2_ump_get_midi2_pitch_bend_data(p) >> 18;
+            bytes[0] = CMIDI2_STATUS_PITCH_BEND + channel;
+            bytes[1] = data & 0x7F;
+            bytes[2] = data >> 7;
+            ayumi_process_midi_event(bytes, 3);
+            break;
+        case CMIDI2_STATUS_CC:
+            data = cmidi2_ump_get_midi2_cc_data(p);
+            switch (cmidi2_ump_get_midi2_cc_index(p)) {
+            case AYUMI_LV2_MIDI_CC_ENVELOPE_H:
+                // the whole envelope period in one message, instead of 10h-12h.
+                a->state.envelope = data >> 16;
+                ayumi_set_envelope(&a->impl, a->state.envelope);
+                break;
+            case AYUMI_LV2_MIDI_CC_ENVELOPE_M:
+            case AYUMI_LV2_MIDI_CC_ENVELOPE_L:
+                break;
+            case CMIDI2_CC_PAN:
+                a->state.pan[channel] = (float) (data / 4294967296.0);
+                ayumi_set_pan(&a->impl, channel, a->state.pan[channel], 0);
+                break;
+            default:
+                bytes[1] = cmidi2_ump_get_midi2_cc_index(p);
+                bytes[2] = data >> 25;
+                ayumi_process_midi_event(bytes, 3);
+                break;
+            }
+            break;
+        case CMIDI2_STATUS_NRPN:
+            if (cmidi2_ump_get_midi2_nrpn_msb(p) != 0)
+                break;
+            data = cmidi2_ump_get_midi2_nrpn_data(p);
+            switch (cmidi2_ump_get_midi2_nrpn_lsb(p)) {
+            case AYUMI_UMP_NRPN_ENVELOPE:
+                a->state.envelope = data >> 16;
+                ayumi_set_envelope(&a->impl, a->state.envelope);
+                break;
+            case AYUMI_UMP_NRPN_ENVELOPE_SHAPE:
+                a->state.envelope_shape = data >> 28;
+                ayumi_restart_envelope(a->state.envelope_shape);
+                break;
+            case AYUMI_UMP_NRPN_TONE:
+                ayumi_set_tone(&a->impl, channel, data >> 20);
+                break;
+            case AYUMI_UMP_NRPN_SOFTENV_NUM_POINTS:
+                a->state.softenv_form[channel].num_points = std::min(6, (int) (data >> 29));
+                break;
+            default:
+                if (AYUMI_UMP_NRPN_SOFTENV_POINT_0 <= cmidi2_ump_get_midi2_nrpn_lsb(p)
+                    && cmidi2_ump_get_midi2_nrpn_lsb(p) <= AYUMI_UMP_NRPN_SOFTENV_POINT_5) {
+                    int para = cmidi2_ump_get_midi2_nrpn_lsb(p) - AYUMI_UMP_NRPN_SOFTENV_POINT_0;
+                    if (para % 2)
+                        break;
+                    auto &stop = a->state.softenv_form[channel].stops[para / 2];
+                    stop.stopAt = (float) (data >> 16) * 0.001f;
+                    stop.volumeRatio = (float) (data & 0xFFFF) / 65535.0f;
+                }
+                break;
+            }
+            break;
+        default:
+            break;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void AyumiAudioProcessor::processUmpBlock(juce::AudioBuffer<float>& buffer, const uint32_t* ump, int numInts)
+{
+    auto *a = &ayumi;
+    juce::ScopedNoDenormals noDenormals;
+    auto governorStart = juce::Time::getHighResolutionTicks();
+    AYUMI_STATS(auto statsStart = processStats.beginBlock());
+    auto sample_count = buffer.getNumSamples();
+    AYUMI_TRACE_SCOPE(trace, "processUmpBlock", "frames", sample_count, "ints", numInts);
+
+    for (auto i = getTotalNumInputChannels(); i < getTotalNumOutputChannels(); ++i)
+        buffer.clear (i, 0, sample_count);
+
+    const juce::SpinLock::ScopedTryLockType registerLogScope{registerLogLock};
+    a->register_log_playing = registerLogScope.isLocked() && syncRegisterLog();
+    const juce::SpinLock::ScopedTryLockType registerCaptureScope{registerCaptureLock};
+    a->capture = registerCaptureScope.isLocked() ? registerCapture.get() : nullptr;
+    applyPendingChanges();
+    ayumi_capture_registers(0); // parameter changes since the last block
+
+    // JR Timestamps are delta times (in 1/31250 seconds) from the top of the block or the previous timestamp.
+    int currentFrame = 0;
+    double timestamp = 0;
+    for (int i = 0; i < numInts; i += ump_size_in_ints(ump[i])) {
+        if (i + ump_size_in_ints(ump[i]) > numInts)
+            break; // truncated packet
+        auto p = const_cast<cmidi2_ump*>(ump + i);
+        if (cmidi2_ump_get_message_type(p) == CMIDI2_MESSAGE_TYPE_UTILITY
+            && cmidi2_ump_get_status_code(p) == CMIDI2_JR_TIMESTAMP) {
+            timestamp += (double) cmidi2_ump_get_jr_timestamp_timestamp(p) * a->sample_rate / JR_TIMESTAMP_TICKS_PER_SECOND;
+            int max = (int) timestamp < sample_count ? (int) timestamp : sample_count;
+            if (max > currentFrame) {
+                processFrames(buffer, currentFrame, max);
+                currentFrame = max;
+            }
+            continue;
+        }
+        ayumi_process_ump_event(ump + i);
+        ayumi_capture_registers(currentFrame);
+        AYUMI_STATS(processStats.addMidiEvent());
+    }
+
+    processFrames(buffer, currentFrame, sample_count);
+    if (a->capture != nullptr)
+        a->capture->endBlock(sample_count);
+    a->capture = nullptr;
+
+    a->totalProcessRunSeconds += (float) sample_count / (float) a->sample_rate;
+    updateGovernor(governorStart, sample_count);
+    AYUMI_STATS(processStats.endBlock(statsStart, sample_count));
+}
+
 void AyumiAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
     auto *a = &ayumi;
     juce::ScopedNoDenormals noDenormals;
+    auto governorStart = juce::Time::getHighResolutionTicks();
+    AYUMI_STATS(auto statsStart = processStats.beginBlock());
     auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
     auto sample_count = buffer.getNumSamples();
+    AYUMI_TRACE_SCOPE(trace, "processBlock", "frames", sample_count, "events", midiMessages.getNumEvents());
 
     // In case we have more outputs than inputs, this code clears any output
     // channels that didn't contain input data, (because these aren't
@@ -397,38 +1090,291 @@ void AyumiAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::
         // ..do something to the data...
     }
 
+    // If the register log is being replaced right now, it just does not advance in this block.
+    const juce::SpinLock::ScopedTryLockType registerLogScope{registerLogLock};
+    a->register_log_playing = registerLogScope.isLocked() && syncRegisterLog();
+    const juce::SpinLock::ScopedTryLockType registerCaptureScope{registerCaptureLock};
+    a->capture = registerCaptureScope.isLocked() ? registerCapture.get() : nullptr;
+    applyPendingChanges();
+    ayumi_capture_registers(0); // parameter changes since the last block
+
 	int currentFrame = 0;
 
-	for(auto msgRef : midiMessages) {
-        auto msg = msgRef.getMessage();
-		if (msg.getTimeStamp() != 0) {
-			int max = currentFrame + (int) msg.getTimeStamp();
-			max = max < sample_count ? max : sample_count;
+	// Events are decoded from the raw bytes in the MidiBuffer; we never build juce::MidiMessage
+	// on the audio thread (it may allocate for longer messages).
+	for (const auto metadata : midiMessages) {
+		if (metadata.samplePosition > currentFrame) {
+			int max = metadata.samplePosition < sample_count ? metadata.samplePosition : sample_count;
             processFrames(buffer, currentFrame, max);
 			currentFrame = max;
 		}
-        ayumi_process_midi_event(msg);
+        ayumi_process_midi_event(metadata.data, metadata.numBytes);
+        ayumi_capture_registers(currentFrame);
+        AYUMI_STATS(processStats.addMidiEvent());
 	}
 
     processFrames(buffer, currentFrame, sample_count);
+    if (a->capture != nullptr)
+        a->capture->endBlock(sample_count);
+    a->capture = nullptr;
 
     a->totalProcessRunSeconds += (float) sample_count / (float) a->sample_rate;
+    updateGovernor(governorStart, sample_count);
+    AYUMI_STATS(processStats.endBlock(statsStart, sample_count));
+}
+
+// Audio thread: picks the quality tier for the next block from the load of this one.
+void AyumiAudioProcessor::updateGovernor(juce::int64 startTicks, int numFrames)
+{
+    auto *a = &ayumi;
+    int tier = a->impl.quality;
+    if (!governorEnabled.load(std::memory_order_relaxed) || isNonRealtime() || numFrames == 0) {
+        tier = AYUMI_QUALITY_FULL;
+        governorLoad = governorOverSeconds = governorUnderSeconds = 0;
+    } else {
+        auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+        auto blockSeconds = (double) numFrames / a->sample_rate;
+        auto budget = governorBudget.load(std::memory_order_relaxed);
+        governorLoad += (seconds / blockSeconds - governorLoad) * AYUMI_GOVERNOR_SMOOTHING;
+        governorOverSeconds = governorLoad > budget ? governorOverSeconds + blockSeconds : 0;
+        governorUnderSeconds = governorLoad < budget * AYUMI_GOVERNOR_STEP_UP_RATIO ? governorUnderSeconds + blockSeconds : 0;
+        // one step at a time, and each step has to be earned again from there.
+        if (governorOverSeconds >= AYUMI_GOVERNOR_STEP_DOWN_SECONDS && tier < AYUMI_QUALITY_TIERS - 1) {
+            tier++;
+            governorOverSeconds = governorUnderSeconds = 0;
+        } else if (governorUnderSeconds >= AYUMI_GOVERNOR_STEP_UP_SECONDS && tier > AYUMI_QUALITY_FULL) {
+            tier--;
+            governorOverSeconds = governorUnderSeconds = 0;
+        }
+    }
+    if (tier == a->impl.quality)
+        return;
+    ayumi_set_quality(&a->impl, a->stems.get(), tier);
+    qualityTier = tier; // reported to the host from timerCallback()
+}
+
+bool AyumiAudioProcessor::loadRegisterLog(const juce::File& file, juce::String& error, bool loop)
+{
+    std::unique_ptr<juce::MemoryMappedFile> mapped{new juce::MemoryMappedFile(file, juce::MemoryMappedFile::readOnly)};
+    if (mapped->getData() == nullptr) {
+        error = "Cannot open " + file.getFullPathName();
+        return false;
+    }
+    RegisterLogPlayer player;
+    const char* message;
+    if (!player.open((const uint8_t*) mapped->getData(), mapped->getSize(), &message)) {
+        error = message;
+        return false;
+    }
+    player.setLooping(loop);
+
+    {
+        const juce::SpinLock::ScopedLockType lock{registerLogLock};
+        std::swap(registerLog, player);
+        std::swap(registerLogFile, mapped);
+        registerLogSource = file;
+        ayumi.register_log_changed = true;
+    }
+    return true; // the previous mapping (if any) is released here, outside the lock.
+}
+
+void AyumiAudioProcessor::unloadRegisterLog()
+{
+    std::unique_ptr<juce::MemoryMappedFile> mapped{};
+    const juce::SpinLock::ScopedLockType lock{registerLogLock};
+    registerLog.close();
+    std::swap(registerLogFile, mapped);
+    registerLogSource = juce::File{};
+    ayumi.register_log_changed = true;
+}
+
+bool AyumiAudioProcessor::loadPresetBank(const juce::File& file, juce::String& error)
+{
+    std::unique_ptr<juce::MemoryMappedFile> mapped{new juce::MemoryMappedFile(file, juce::MemoryMappedFile::readOnly)};
+    if (mapped->getData() == nullptr) {
+        error = "Cannot open " + file.getFullPathName();
+        return false;
+    }
+    PresetBank bank;
+    const char* message;
+    if (!bank.open((const uint8_t*) mapped->getData(), mapped->getSize(), sizeof(AyumiState), &message)) {
+        error = message;
+        return false;
+    }
+
+    {
+        const juce::SpinLock::ScopedLockType lock{presetBankLock};
+        presetBank = bank;
+        std::swap(presetBankFile, mapped);
+    }
+    currentProgram = 0;
+    updateHostDisplay(ChangeDetails{}.withProgramChanged(true));
+    return true; // the previous mapping (if any) is released here, outside the lock.
+}
+
+void AyumiAudioProcessor::unloadPresetBank()
+{
+    std::unique_ptr<juce::MemoryMappedFile> mapped{};
+    {
+        const juce::SpinLock::ScopedLockType lock{presetBankLock};
+        presetBank.close();
+        std::swap(presetBankFile, mapped);
+    }
+    currentProgram = 0;
+    updateHostDisplay(ChangeDetails{}.withProgramChanged(true));
+}
+
+bool AyumiAudioProcessor::savePreset(const juce::File& bankFile, const juce::String& name, juce::String& error)
+{
+    juce::MemoryBlock data;
+    int numPresets = 0;
+    if (bankFile.existsAsFile()) {
+        PresetBank bank;
+        const char* message;
+        if (!bankFile.loadFileAsData(data)) {
+            error = "Cannot read " + bankFile.getFullPathName();
+            return false;
+        }
+        if (!bank.open((const uint8_t*) data.getData(), data.getSize(), sizeof(AyumiState), &message)) {
+            error = message;
+            return false;
+        }
+        numPresets = bank.getNumPresets();
+        // drop anything after the last record.
+        data.setSize(PRESET_BANK_HEADER_SIZE + (size_t) numPresets * (PRESET_BANK_NAME_SIZE + sizeof(AyumiState)));
+    } else
+        data.setSize(PRESET_BANK_HEADER_SIZE, true);
+
+    uint8_t record[PRESET_BANK_NAME_SIZE + sizeof(AyumiState)]{};
+    name.copyToUTF8((char*) record, PRESET_BANK_NAME_SIZE); // truncated, and always terminated
+    auto state = copyState();
+    memcpy(record + PRESET_BANK_NAME_SIZE, &state, sizeof(AyumiState));
+    data.append(record, sizeof(record));
+    PresetBank::writeHeader((uint8_t*) data.getData(), sizeof(AyumiState), numPresets + 1);
+
+    // written to a temporary file and then moved, so that a mapping of the old file stays valid.
+    if (!bankFile.replaceWithData(data.getData(), data.getSize())) {
+        error = "Cannot write " + bankFile.getFullPathName();
+        return false;
+    }
+    return true;
+}
+
+bool AyumiAudioProcessor::startRegisterCapture(const juce::File& file, juce::String& error)
+{
+    stopRegisterCapture();
+    bool isYM = true;
+    int32_t clockRate = copyState().clock_rate;
+    {
+        const juce::SpinLock::ScopedLockType lock{registerLogLock};
+        if (registerLog.isOpen()) {
+            isYM = registerLog.isYM();
+            clockRate = registerLog.getClockRate();
+        }
+    }
+    std::unique_ptr<RegisterCapture> capture{new RegisterCapture(file, clockRate, isYM, ayumi.sample_rate)};
+    if (!capture->start(error))
+        return false;
+    const juce::SpinLock::ScopedLockType lock{registerCaptureLock};
+    std::swap(registerCapture, capture);
+    return true;
+}
+
+void AyumiAudioProcessor::stopRegisterCapture()
+{
+    std::unique_ptr<RegisterCapture> capture{};
+    {
+        const juce::SpinLock::ScopedLockType lock{registerCaptureLock};
+        std::swap(registerCapture, capture);
+    }
+    // the rest of the ring is written and the file is completed here, outside the lock.
+    if (capture != nullptr)
+        capture->stop();
+}
+
+// Called on the audio thread at the top of every block, with registerLogLock held.
+// Returns true if the register log advances in this block.
+bool AyumiAudioProcessor::syncRegisterLog() {
+    auto *a = &ayumi;
+    if (a->register_log_changed) {
+        a->register_log_changed = false;
+        if (registerLog.isOpen()) {
+            // the log has its own clock (and chip type).
+            ayumi_reconfigure(&a->impl, a->stems.get(), registerLog.isYM(), registerLog.getClockRate(), a->sample_rate);
+            registerLog.setSampleRate(a->sample_rate);
+            registerLog.seek(0);
+        } else {
+            ayumi_reconfigure(&a->impl, a->stems.get(), 1, a->state.clock_rate, a->sample_rate);
+            for (int i = 0; i < 3; i++)
+                if (!a->note_on_state[i])
+                    ayumi_set_mixer(&a->impl, i, 1, 1, 0);
+            a->registers_active = false;
+        }
+    }
+    if (!registerLog.isOpen())
+        return false;
+
+    juce::AudioPlayHead::CurrentPositionInfo info;
+    auto playHead = getPlayHead();
+    if (playHead != nullptr && playHead->getCurrentPosition(info)) {
+        // the chip is not rendered while the transport is stopped (unless notes are on).
+        a->registers_active = info.isPlaying;
+        if (!info.isPlaying)
+            return false;
+        // on host seeks (and loops), the register file is restored from the seek index and the nearest writes.
+        if (info.timeInSamples != registerLog.getPosition())
+            registerLog.seek(std::max((juce::int64) 0, info.timeInSamples));
+    }
+    return true;
 }
 
 void AyumiAudioProcessor::processFrames(juce::AudioBuffer<float>& buffer, int start, int end) {
+    AYUMI_TRACE_SCOPE(trace, "processFrames", "start", start, "end", end);
+    if (!ayumi.register_log_playing) {
+        renderFrames(buffer, start, end);
+        return;
+    }
+    // register log writes split the frames further, at their own positions.
+    while (start < end) {
+        int n = registerLog.process(end - start);
+        ayumi_apply_register_log();
+        ayumi_capture_registers(start);
+        renderFrames(buffer, start, start + n);
+        start += n;
+    }
+}
+
+void AyumiAudioProcessor::renderFrames(juce::AudioBuffer<float>& buffer, int start, int end) {
+    AYUMI_STATS(if (end > start) processStats.addSubBlock());
     // If we support release envelope this optimization will have to change
     if (!ayumi.active)
         return;
-    if(!ayumi.note_on_state[0] && !ayumi.note_on_state[1] && !ayumi.note_on_state[2])
+    if(!ayumi.note_on_state[0] && !ayumi.note_on_state[1] && !ayumi.note_on_state[2] && !ayumi.registers_active)
         return;
 
     auto *a = &ayumi;
-    auto totalNumInputChannels  = getTotalNumInputChannels();
-    auto totalNumOutputChannels = getTotalNumOutputChannels();
+    auto mainOut = getBusBuffer(buffer, false, 0);
+    int nCh = mainOut.getNumChannels();
+
+    // Per-channel outputs. Only enabled buses are written, but once any of them is enabled
+    // every channel goes through its own FIR/DC chain and the mix is the sum of them.
+    struct ayumi_stem* stems = a->stems.get();
+    float* stemOut[TONE_CHANNELS][2]{};
+    for (int ch = 0; stems != nullptr && ch < TONE_CHANNELS; ch++) {
+        auto bus = getBus(false, 1 + ch);
+        if (bus == nullptr || !bus->isEnabled())
+            continue;
+        auto stemBuffer = getBusBuffer(buffer, false, 1 + ch);
+        stemOut[ch][0] = stemBuffer.getNumChannels() > 0 ? stemBuffer.getWritePointer(0) : nullptr;
+        stemOut[ch][1] = stemBuffer.getNumChannels() > 1 ? stemBuffer.getWritePointer(1) : nullptr;
+    }
 
     float secondsPerFrame = 1.0f / (float) a->sample_rate;
     float positionInSeconds = a->totalProcessRunSeconds;
     int v_cache[3]{-1, -1, -1};
+   #if AYUMI_JUCE_INSTRUMENTATION
+    int cachedFrames = 0; // served from the tone cache, without running the FIRs
+   #endif
     for (int i = start; i < end; i++) {
         // adjust volume for software envelope
         if (i % 25 == 0) {
@@ -444,20 +1390,64 @@ void AyumiAudioProcessor::processFrames(juce::AudioBuffer<float>& buffer, int st
                 if (v != v_cache[ch]) {
                     ayumi_set_volume(&a->impl, ch, v);
                     v_cache[ch] = v;
+                    ayumi_capture_registers(i);
                 }
             }
         }
 
-        ayumi_process(&a->impl);
-        ayumi_remove_dc(&a->impl);
-        int nCh = totalNumOutputChannels - totalNumInputChannels;
+        if (a->fast_forward) {
+            if (a->tone_cache != nullptr)
+                ayumi_tone_cache_flush(&a->impl, a->tone_cache.get());
+            // no filters and no output while fast-forwarding; the chip is advanced in closed form
+            // up to the next software envelope step at once.
+            int n = std::min(end, (i / 25 + 1) * 25) - i;
+            ayumi_fast_forward(&a->impl, n);
+            for (int j = 0; j < n; j++)
+                positionInSeconds += secondsPerFrame;
+            i += n - 1;
+            continue;
+        }
+
+        if (stems != nullptr) {
+            ayumi_process_stems(&a->impl, stems);
+            ayumi_remove_dc_stems(&a->impl, stems);
+            for (int ch = 0; ch < TONE_CHANNELS; ch++) {
+                if (stemOut[ch][1] != nullptr) {
+                    stemOut[ch][0][i] = (float) stems[ch].left;
+                    stemOut[ch][1][i] = (float) stems[ch].right;
+                } else if (stemOut[ch][0] != nullptr)
+                    stemOut[ch][0][i] = (float) ((stems[ch].left + stems[ch].right) * 0.5);
+            }
+            if (nCh == 1)
+                a->impl.left = (a->impl.left + a->impl.right) * 0.5;
+        } else if (nCh == 1) {
+            // mono bus: mix the panned channels once and run only one FIR/DC chain.
+            ayumi_process_mono(&a->impl);
+            ayumi_remove_dc_mono(&a->impl);
+        } else {
+            if (a->tone_cache != nullptr) {
+                ayumi_process_cached(&a->impl, a->tone_cache.get());
+               #if AYUMI_JUCE_INSTRUMENTATION
+                cachedFrames += a->tone_cache->active;
+               #endif
+            } else
+                ayumi_process(&a->impl);
+            ayumi_remove_dc(&a->impl);
+        }
         if (nCh > 0)
-            auto &ptr = buffer.getWritePointer(totalNumInputChannels)[i] = (float) ayumi.impl.left;
+            mainOut.getWritePointer(0)[i] = (float) ayumi.impl.left;
         if (nCh > 1)
-            auto &ptr = buffer.getWritePointer(totalNumInputChannels + 1)[i] = (float) ayumi.impl.right;
+            mainOut.getWritePointer(1)[i] = (float) ayumi.impl.right;
 
         positionInSeconds += secondsPerFrame;
     }
+
+   #if AYUMI_JUCE_INSTRUMENTATION
+    processStats.addChipTicks((juce::uint64) llround((end - start) * a->impl.decimate_factor * a->impl.step));
+    if (!a->fast_forward)
+        processStats.addFirInvocations((juce::uint64) (end - start - cachedFrames)
+                                       * (stems != nullptr ? TONE_CHANNELS * 2 : nCh == 1 ? 1 : 2));
+   #endif
 }
 
 //==============================================================================
@@ -468,115 +1458,245 @@ bool AyumiAudioProcessor::hasEditor() const
 
 juce::AudioProcessorEditor* AyumiAudioProcessor::createEditor()
 {
+   #if AYUMI_JUCE_INSTRUMENTATION
+    return new AyumiAudioProcessorEditor (*this); // the parameters and the processing statistics
+   #else
     return new juce::GenericAudioProcessorEditor (*this);
+   #endif
 }
 
 //==============================================================================
 void AyumiAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
     juce::MemoryOutputStream stream{destData, false};
+    // a preset switch replaces the whole state on the audio thread. A loaded state may not have reached it yet.
+    auto state = copyState();
 
     for (int i = 0; i < 3; i++)
-        stream.writeInt(ayumi.state.mixer[i]);
+        stream.writeInt(state.mixer[i]);
     for (int i = 0; i < 3; i++)
-        stream.writeInt(ayumi.state.volume[i]);
+        stream.writeInt(state.volume[i]);
     for (int i = 0; i < 3; i++)
-        stream.writeFloat(ayumi.state.pan[i]);
-    stream.writeInt(ayumi.state.envelope);
-    stream.writeInt(ayumi.state.envelope_shape);
-    stream.writeInt(ayumi.state.noise_freq);
-    stream.writeInt(ayumi.state.clock_rate);
+        stream.writeFloat(state.pan[i]);
+    stream.writeInt(state.envelope);
+    stream.writeInt(state.envelope_shape);
+    stream.writeInt(state.noise_freq);
+    stream.writeInt(state.clock_rate);
 
     for (int i = 0; i < 3; i++) {
-        stream.writeInt(ayumi.state.softenv_form[i].num_points);
+        stream.writeInt(state.softenv_form[i].num_points);
         for (int p = 0; p < 6; p++) {
-            stream.writeFloat(ayumi.state.softenv_form[i].stops[p].stopAt);
-            stream.writeFloat(ayumi.state.softenv_form[i].stops[p].volumeRatio);
+            stream.writeFloat(state.softenv_form[i].stops[p].stopAt);
+            stream.writeFloat(state.softenv_form[i].stops[p].volumeRatio);
         }
     }
 
+    // optional, absent in older states.
+    stream.writeString(registerLogSource.getFullPathName());
+    stream.writeInt(currentProgram);
+    stream.writeBool(lowLatencyEnabled);
+
     stream.flush();
 }
 
 void AyumiAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    if (sizeInBytes < AYUMI_NUM_PARAMETERS * 4)
+    if (sizeInBytes < AYUMI_NUM_STATE_PARAMETERS * 4)
         return; // insufficient space
     juce::MemoryInputStream stream{data, (size_t) sizeInBytes, true};
+    AyumiState state{}; // read as a whole, as the audio thread may be reading the current one
 
     for (int i = 0; i < 3; i++)
-        ayumi.state.mixer[i] = stream.readInt();
+        state.mixer[i] = stream.readInt();
     for (int i = 0; i < 3; i++)
-        ayumi.state.volume[i] = stream.readInt();
+        state.volume[i] = stream.readInt();
     for (int i = 0; i < 3; i++)
-        ayumi.state.pan[i] = stream.readFloat();
-    ayumi.state.envelope = stream.readInt();
-    ayumi.state.envelope_shape = stream.readInt();
-    ayumi.state.noise_freq = stream.readInt();
-    ayumi.state.clock_rate = stream.readInt();
+        state.pan[i] = stream.readFloat();
+    state.envelope = stream.readInt();
+    state.envelope_shape = stream.readInt();
+    state.noise_freq = stream.readInt();
+    state.clock_rate = stream.readInt();
 
     for (int i = 0; i < 3; i++) {
-        ayumi.state.softenv_form[i].num_points = stream.readInt();
+        state.softenv_form[i].num_points = stream.readInt();
         for (int p = 0; p < 6; p++) {
-            ayumi.state.softenv_form[i].stops[p].stopAt = stream.readFloat();
-            ayumi.state.softenv_form[i].stops[p].volumeRatio = stream.readFloat();
+            state.softenv_form[i].stops[p].stopAt = stream.readFloat();
+            state.softenv_form[i].stops[p].volumeRatio = stream.readFloat();
         }
     }
 
-    ayumi.state.magic_number = AYUMI_JUCE_STATE_MAGIC_NUMBER;
+    auto registerLogPath = stream.isExhausted() ? juce::String{} : stream.readString();
+    juce::String error;
+    if (registerLogPath.isEmpty())
+        unloadRegisterLog();
+    else if (!loadRegisterLog(juce::File{registerLogPath}, error))
+        DBG(error);
+
+    // the program the state was saved on. Hosts set it again after restoring the state, which is then ignored
+    // (setCurrentProgram()) instead of overwriting the state with the preset. A switch requested before is dropped.
+    pendingProgram = -1;
+    currentProgram = stream.isExhausted() ? 0 : stream.readInt();
+    // taken over at the next prepareToPlay(), which reports the new latency to the host.
+    lowLatencyEnabled = !stream.isExhausted() && stream.readBool();
+
+    state.magic_number = AYUMI_JUCE_STATE_MAGIC_NUMBER;
+    {
+        // taken over by the audio thread at the next block (applyPendingChanges()), or by prepareToPlay().
+        const juce::SpinLock::ScopedLockType lock{stateLock};
+        pendingState = state;
+        stateChanged = true;
+        dirtyParameters = 0; // changes made before are replaced by the loaded state
+    }
+
+    // The parameters are updated silently and the host is told once that they all changed, instead of a change
+    // notification per parameter. The engine is configured once as well: at the next prepareToPlay(), or at the
+    // next block if it is already playing.
+    setParametersFromState(state);
+    updateHostDisplay(ChangeDetails{}.withProgramChanged(true).withParameterInfoChanged(true));
+}
+
+void AyumiAudioProcessor::saveSnapshot(juce::MemoryBlock& destData)
+{
+    static_assert(std::is_trivially_copyable<AyumiState>::value, "AyumiState must be plain data");
+    static_assert(std::is_trivially_copyable<RegisterLogPlayer::State>::value, "RegisterLogPlayer::State must be plain data");
+    auto *a = &ayumi;
+    juce::MemoryOutputStream stream{destData, false};
+
+    // structures are stored as they are in memory, so the sizes work as a (weak) layout check.
+    stream.writeInt(AYUMI_SNAPSHOT_MAGIC_NUMBER);
+    stream.writeInt(AYUMI_SNAPSHOT_VERSION);
+    stream.writeInt((int) sizeof(struct ayumi_snapshot));
+    stream.writeInt((int) sizeof(AyumiState));
+
+    // pending parameter changes are taken into the state and the engine first.
+    applyPendingChanges();
+    struct ayumi_snapshot chip;
+    if (a->tone_cache != nullptr)
+        ayumi_tone_cache_flush(&a->impl, a->tone_cache.get());
+    ayumi_save(&a->impl, &chip);
+    stream.write(&chip, sizeof(chip));
+    stream.write(&a->state, sizeof(a->state));
+
+    stream.writeInt(a->sample_rate);
+    stream.writeBool(a->active);
+    for (int i = 0; i < 3; i++) {
+        stream.writeInt(a->pitchbend[i]);
+        stream.writeBool(a->note_on_state[i]);
+        stream.writeFloat(a->softenv[i].started_at);
+    }
+    stream.writeFloat(a->pitchbend_sensitivity);
+    stream.writeBool(a->registers_active);
+    stream.write(a->registers, sizeof(a->registers));
+    stream.writeBool(a->envelope_restarted);
+    stream.writeInt(a->sysex_size);
+    stream.writeInt(a->preset_bank_select);
+    stream.write(a->sysex_buffer, sizeof(a->sysex_buffer));
+    stream.writeFloat(a->totalProcessRunSeconds);
+
+    stream.writeBool(a->stems != nullptr);
+    if (a->stems != nullptr)
+        stream.write(a->stems.get(), sizeof(struct ayumi_stem) * TONE_CHANNELS);
+
+    const juce::SpinLock::ScopedLockType lock{registerLogLock};
+    stream.writeBool(registerLog.isOpen());
+    if (registerLog.isOpen()) {
+        auto logState = registerLog.getState();
+        stream.write(&logState, sizeof(logState));
+    }
+    stream.flush();
+}
+
+bool AyumiAudioProcessor::restoreSnapshot(const void* data, size_t sizeInBytes)
+{
+    auto *a = &ayumi;
+    juce::MemoryInputStream stream{data, sizeInBytes, false};
+    if (stream.readInt() != AYUMI_SNAPSHOT_MAGIC_NUMBER || stream.readInt() != AYUMI_SNAPSHOT_VERSION
+        || stream.readInt() != (int) sizeof(struct ayumi_snapshot) || stream.readInt() != (int) sizeof(AyumiState))
+        return false;
+
+    struct ayumi_snapshot chip;
+    AyumiState state;
+    if (stream.read(&chip, sizeof(chip)) != (int) sizeof(chip) || stream.read(&state, sizeof(state)) != (int) sizeof(state))
+        return false;
+    ayumi_restore(&a->impl, &chip);
+    if (a->tone_cache != nullptr)
+        ayumi_tone_cache_reset(a->tone_cache.get());
+    a->state = state;
+    stateChanged = false;
+    dirtyParameters = 0;
+    a->configured = true;
+
+    a->sample_rate = stream.readInt();
+    a->active = stream.readBool();
+    for (int i = 0; i < 3; i++) {
+        a->pitchbend[i] = stream.readInt();
+        a->note_on_state[i] = stream.readBool();
+        a->softenv[i].started_at = stream.readFloat();
+    }
+    a->pitchbend_sensitivity = stream.readFloat();
+    a->registers_active = stream.readBool();
+    stream.read(a->registers, sizeof(a->registers));
+    a->envelope_restarted = stream.readBool();
+    a->sysex_size = stream.readInt();
+    a->preset_bank_select = stream.readInt();
+    stream.read(a->sysex_buffer, sizeof(a->sysex_buffer));
+    a->totalProcessRunSeconds = stream.readFloat();
+
+    // stems exist only if the channel buses are enabled in both.
+    if (stream.readBool()) {
+        if (a->stems == nullptr)
+            return false;
+        stream.read(a->stems.get(), sizeof(struct ayumi_stem) * TONE_CHANNELS);
+    } else if (a->stems != nullptr)
+        return false;
+
+    const juce::SpinLock::ScopedLockType lock{registerLogLock};
+    if (stream.readBool() && registerLog.isOpen()) {
+        RegisterLogPlayer::State logState;
+        if (stream.read(&logState, sizeof(logState)) != (int) sizeof(logState))
+            return false;
+        registerLog.setSampleRate(a->sample_rate);
+        registerLog.setState(logState);
+        // the clock is already restored as part of the chip.
+        a->register_log_changed = false;
+    }
+    return true;
+}
+
+juce::int64 AyumiAudioProcessor::getPrerollStart(juce::int64 position) const
+{
+    // the DC filter state is exact only after its resync (every DC_FILTER_SIZE frames) with DC_FILTER_SIZE exact
+    // inputs, and they need the interpolator and the FIR to be filled first.
+    auto resync = position / DC_FILTER_SIZE * DC_FILTER_SIZE;
+    return std::max((juce::int64) 0, resync - DC_FILTER_SIZE - ayumi_preroll_frames(&ayumi.impl));
 }
 
 void AyumiAudioProcessor::audioProcessorParameterChanged(juce::AudioProcessor *processor, int parameterIndex,
                                                          float newValue) {
-    if (parameterIndex <= AYUMI_PARAMETER_MIXER_2_INDEX) {
-        ayumi.state.mixer[parameterIndex % 3] = (int) mixerRange.convertFrom0to1(newValue);
-    } else if (parameterIndex <= AYUMI_PARAMETER_VOLUME_2_INDEX) {
-        auto vol = (int) volumeRange.convertFrom0to1(newValue);
-        ayumi.state.volume[parameterIndex % 3] = vol;
-        ayumi_set_volume(&ayumi.impl, parameterIndex % 3, vol);
-    } else if (parameterIndex <= AYUMI_PARAMETER_PAN_2_INDEX) {
-        ayumi.state.pan[parameterIndex % 3] = newValue;
-        ayumi_set_pan(&ayumi.impl, parameterIndex % 3, newValue, false);
-    } else {
-        int env, shape, noise, clock;
-        switch(parameterIndex) {
-            case AYUMI_PARAMETER_ENVELOPE_INDEX:
-                env = (int) envelopeRange.convertFrom0to1(newValue);
-                ayumi.state.envelope = env;
-                ayumi_set_envelope(&ayumi.impl, env);
-                break;
-            case AYUMI_PARAMETER_ENVELOPE_SHAPE_INDEX:
-                shape = (int) envelopeShapeRange.convertFrom0to1(newValue);
-                ayumi.state.envelope_shape = shape;
-                ayumi_set_envelope_shape(&ayumi.impl, shape);
-                break;
-            case AYUMI_PARAMETER_NOISE_INDEX:
-                noise = (int) noiseFreqRange.convertFrom0to1(newValue);
-                ayumi.state.noise_freq = noise;
-                ayumi_set_noise(&ayumi.impl, noise);
-                break;
-            case AYUMI_PARAMETER_CLOCK_RATE_INDEX:
-                clock = (int) clockRange.convertFrom0to1(newValue);
-                ayumi.state.clock_rate = clock;
-                ayumi_configure(&ayumi.impl, 1, clock, ayumi.sample_rate);
-                break;
-            default:
-                if (AYUMI_PARAMETER_SOFTENV_0_NUM_POINTS <= parameterIndex && parameterIndex <= AYUMI_PARAMETER_SOFTENV_0_POINT_0_CLOCK + 12) {
-                    auto targetCh = (parameterIndex - AYUMI_PARAMETER_SOFTENV_0_POINT_0_CLOCK) / 13;
-                    auto offset = parameterIndex - targetCh * 13 - AYUMI_PARAMETER_SOFTENV_0_NUM_POINTS;
-                    if (offset == 0)
-                        ayumi.state.softenv_form[targetCh].num_points = (int) softwareEnvelopeNumStopsRange.convertFrom0to1(newValue);
-                    else {
-                        auto &stop = ayumi.state.softenv_form[targetCh].stops[(offset - 1) / 2];
-                        if (offset % 2)
-                            stop.stopAt = softwareEnvelopeStopSecondsRange.convertFrom0to1(newValue);
-                        else
-                            stop.volumeRatio = softwareEnvelopeStopRatioRange.convertFrom0to1(newValue);
-                    }
-                }
-                break;
-        }
+    AYUMI_TRACE_SCOPE(trace, "audioProcessorParameterChanged", "index", parameterIndex);
+    if (parameterIndex < 0 || parameterIndex >= AYUMI_NUM_PARAMETERS)
+        return;
+    auto& d = parameterDescriptors[parameterIndex];
+    auto value = (this->*d.range).convertFrom0to1(newValue);
+    if (d.field == ParameterField::ReadOnly)
+        return;
+    if (d.field == ParameterField::LowLatency) {
+        lowLatencyEnabled = value >= 0.5f; // a processor setting, read at prepareToPlay()
+        return;
+    }
+    // The state belongs to the audio thread, which stores the value into it and applies it to the engine at the next
+    // block; until then, copyState() (for saving) takes it from here. Values that did not change (e.g. echoed back
+    // by the host after a state is loaded) change nothing there.
+    if (juce::MessageManager::existsAndIsCurrentThread()) {
+        // a loaded state that the audio thread has not taken yet gets the change as well. The message thread can
+        // wait for the lock; other threads (automation on the audio thread) cannot, but the dirty bit below still
+        // applies the change after the loaded state.
+        const juce::SpinLock::ScopedLockType lock{stateLock};
+        if (stateChanged)
+            setStateValue(pendingState, d, value);
     }
+    changedParameterValues[parameterIndex] = value;
+    dirtyParameters.fetch_or((uint64_t) 1 << parameterIndex);
 }
 
 void AyumiAudioProcessor::audioProcessorChanged (juce::AudioProcessor *processor, const juce::AudioProcessor::ChangeDetails &details)
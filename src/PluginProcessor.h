@@ -11,13 +11,19 @@
 #include <juce_audio_basics/juce_audio_basics.h>
 #include <juce_audio_processors/juce_audio_processors.h>
 #include "ayumi.h"
+#include "RegisterLogPlayer.h"
+#include "RegisterCapture.h"
+#include "PresetBank.h"
+#include "ProcessStats.h"
+#include "TraceRecorder.h"
 
 #define AYUMI_JUCE_STATE_MAGIC_NUMBER 37564
+#define AYUMI_GOVERNOR_DEFAULT_BUDGET 0.6 // fraction of the buffer period
 
 //==============================================================================
 /**
 */
-class AyumiAudioProcessor  : public juce::AudioProcessor, private juce::AudioProcessorListener
+class AyumiAudioProcessor  : public juce::AudioProcessor, private juce::AudioProcessorListener, private juce::Timer
 {
 public:
     //==============================================================================
@@ -33,6 +39,78 @@ public:
    #endif
 
     void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    // Same as processBlock(), but takes MIDI 2.0 UMPs in a contiguous buffer (of `numInts` 32-bit ints).
+    void processUmpBlock (juce::AudioBuffer<float>& buffer, const uint32_t* ump, int numInts);
+
+    //==============================================================================
+    // Register log (YM/VGM) playback mode. The file is memory-mapped while it is loaded, and the playback
+    // follows the host transport (or runs freely from the top if there is no play head).
+    bool loadRegisterLog (const juce::File& file, juce::String& error, bool loop = true);
+    void unloadRegisterLog();
+
+    // Preset bank: fixed-size state records in a file (see PresetBank.h), memory-mapped while it is loaded. The
+    // presets are the host programs, and MIDI channel 16 selects them too (Bank Select MSB/LSB, then Program Change
+    // for preset bank * 128 + program). Switching happens on the audio thread by copying a record over the state,
+    // without allocation or parsing. The AYUMI_JUCE_PRESET_BANK environment variable loads a bank at startup.
+    bool loadPresetBank (const juce::File& file, juce::String& error);
+    void unloadPresetBank();
+    // Appends the current state to `bankFile` as a preset (creating the file if needed). A loaded bank does not
+    // see the new preset until it is loaded again.
+    bool savePreset (const juce::File& bankFile, const juce::String& name, juce::String& error);
+
+    // Captures every effective chip register change (from MIDI, parameters and register logs) into a VGM file,
+    // until stopRegisterCapture() (or the destruction of the processor). Pan is not part of the chip registers.
+    // It also starts automatically if AYUMI_JUCE_CAPTURE_DIR environment variable is set.
+    bool startRegisterCapture (const juce::File& file, juce::String& error);
+    void stopRegisterCapture();
+
+    // Snapshot of the complete engine state: the chip, FIR/interpolator/DC filter history, notes, software envelope
+    // timing and register log position. Restoring it continues bit-identically to the point it was taken.
+    // Snapshots are only compatible with the same build and the same bus layout, and must not be taken or
+    // restored while processBlock() is running.
+    void saveSnapshot (juce::MemoryBlock& destData);
+    bool restoreSnapshot (const void* data, size_t sizeInBytes);
+
+    // In fast-forward mode, processBlock() handles events and advances the chip without running the filters,
+    // and the output is left silent. To get the output from `position` (counted from the first block after
+    // prepareToPlay()) identical to continuous processing, fast-forward only up to getPrerollStart(position)
+    // and process normally from there.
+    void setFastForward (bool enabled) { ayumi.fast_forward = enabled; }
+    juce::int64 getPrerollStart (juce::int64 position) const;
+
+    // The tone cache renders steady tone-only passages from cached band-limited periods instead of emulating
+    // the chip (stereo main output without channel buses only). Takes effect at the next prepareToPlay();
+    // the AYUMI_JUCE_TONE_CACHE=1 environment variable enables it as well.
+    void setToneCacheEnabled (bool enabled) { toneCacheEnabled = enabled; }
+
+    // The low-latency mode replaces the linear-phase decimation filters with minimum-phase ones, which cuts the
+    // latency from about 12 frames to about 2-4 (see ayumi_latency()), for live playing. Takes effect at the next
+    // prepareToPlay(), and disables the tone cache; the AYUMI_JUCE_LOW_LATENCY=1 environment variable enables it
+    // as well. Either way, the latency is reported to the host (setLatencySamples()) at prepareToPlay(). The
+    // setting is the non-automatable "LowLatency" parameter, and is saved in the state.
+    void setLowLatencyEnabled (bool enabled);
+
+    // The CPU budget governor measures each block against its duration, and steps the engine down through the
+    // quality tiers (AYUMI_QUALITY_*) while the load stays above the budget (a fraction of the buffer period),
+    // and back up once it stays well below. It is inactive in non-realtime rendering, which is always at full
+    // quality. The current tier is reported to the host as the read-only "QualityTier" parameter.
+    void setGovernorEnabled (bool enabled) { governorEnabled = enabled; }
+    void setGovernorBudget (double fractionOfPeriod) { governorBudget = fractionOfPeriod; }
+    int getQualityTier() const { return qualityTier.load(); }
+
+   #if AYUMI_JUCE_INSTRUMENTATION
+    // Per-block timing, histogram and counters (only in builds with AYUMI_JUCE_INSTRUMENTATION).
+    ProcessStats& getProcessStats() { return processStats; }
+    double getProcessSampleRate() const { return ayumi.sample_rate; }
+   #endif
+
+   #if AYUMI_JUCE_TRACING
+    // Records a timeline of blocks, event splits, MIDI events and parameter changes into a Chrome trace JSON file,
+    // until stopTrace() (only in builds with AYUMI_JUCE_TRACING). It also starts automatically if
+    // AYUMI_JUCE_TRACE_DIR environment variable is set.
+    bool startTrace (const juce::File& file, juce::String& error) { return trace.start (file, error); }
+    void stopTrace() { trace.stop(); }
+   #endif
 
     //==============================================================================
     juce::AudioProcessorEditor* createEditor() override;
@@ -134,12 +212,27 @@ private:
         AyumiState  state{};
         // non-persistent states
         int32_t sample_rate{44100}; // stored for reconfiguration
+        bool configured{false}; // ayumi_configure() is done only once, later changes go to ayumi_reconfigure().
         bool active{false};
         int32_t pitchbend[3]{0, 0, 0};
         float pitchbend_sensitivity{2.0};
         bool note_on_state[3]{false, false, false};
+        bool registers_active{false}; // set once the chip is driven by register frames instead of notes.
+        uint8_t registers[REGISTER_LOG_NUM_REGISTERS]{}; // last written R0-R13
+        bool register_log_changed{false}; // a register log was (un)loaded, to be applied on the audio thread.
+        bool register_log_playing{false}; // valid only during processBlock().
+        bool fast_forward{false};
+        bool envelope_restarted{false}; // R13 written since the last capture, even if the shape did not change.
+        RegisterCapture* capture{nullptr}; // valid only during processBlock().
+        uint8_t sysex_buffer[64]{}; // for assembling UMP SysEx7 packets
+        int sysex_size{0};
+        int preset_bank_select{0}; // Bank Select MSB * 128 + LSB on the preset channel
         float totalProcessRunSeconds{0.0f};
         EnvelopeInstance softenv[3]{{}, {}, {}};
+        // per-channel FIR/DC chains, allocated at prepareToPlay() only if any channel output bus is enabled.
+        std::unique_ptr<struct ayumi_stem[]> stems{};
+        // allocated at prepareToPlay() only if the tone cache is enabled.
+        std::unique_ptr<struct ayumi_tone_cache> tone_cache{};
 
         inline void reset() {
             state.reset();
@@ -147,10 +240,68 @@ private:
             active = false;
             pitchbend[0] = pitchbend[1] = pitchbend[2] = 0;
             note_on_state[0] = note_on_state[1] = note_on_state[2] = false;
+            registers_active = false;
+            memset(registers, 0, sizeof(registers));
+            preset_bank_select = 0;
         }
     } AyumiContext;
 
+    // What a parameter controls: a state field (of `channel` and soft envelope `stop`, where they apply), the range
+    // of its plain value, and how a change is applied to the engine (nullptr if it is only read from the state).
+    enum class ParameterField : uint8_t {
+        Mixer, Volume, Pan, Envelope, EnvelopeShape, Noise, Clock, SoftEnvNumStops, SoftEnvStopAt, SoftEnvStopRatio,
+        LowLatency, // not a state field: lowLatencyEnabled
+        ReadOnly // reported by the processor, changes from outside are ignored
+    };
+    struct ParameterDescriptor {
+        ParameterField field;
+        int channel;
+        int stop;
+        juce::NormalisableRange<float> AyumiAudioProcessor::* range;
+        void (AyumiAudioProcessor::* apply)(const ParameterDescriptor& d);
+    };
+    static const ParameterDescriptor parameterDescriptors[]; // indexed by parameter index
+
     AyumiContext ayumi;
+    // register log playback. The player and the mapping are replaced only under the lock.
+    RegisterLogPlayer registerLog{};
+    std::unique_ptr<juce::MemoryMappedFile> registerLogFile{};
+    juce::SpinLock registerLogLock{};
+    juce::File registerLogSource{}; // saved in state
+    // register capture. Started and stopped only under the lock.
+    std::unique_ptr<RegisterCapture> registerCapture{};
+    juce::SpinLock registerCaptureLock{};
+    // preset bank. The bank and the mapping are replaced only under the lock.
+    PresetBank presetBank{};
+    std::unique_ptr<juce::MemoryMappedFile> presetBankFile{};
+    juce::SpinLock presetBankLock{};
+    std::atomic<int> pendingProgram{-1}; // a host program change, to be applied on the audio thread.
+    std::atomic<int> currentProgram{0}; // saved in state
+    // taken by the audio thread (try-lock) to replace the whole state, and by the message thread to copy it or to
+    // hand over a loaded one.
+    juce::SpinLock stateLock{};
+    std::atomic<bool> programChanged{false}; // switched on the audio thread, to be reported to the host.
+    bool toneCacheEnabled{false};
+    std::atomic<bool> lowLatencyEnabled{false}; // saved in state, read at prepareToPlay()
+    std::atomic<bool> stateChanged{false}; // a state was loaded (pendingState), to be applied on the audio thread.
+    AyumiState pendingState{}; // under stateLock
+    // parameter changes, taken into the state by the audio thread: a bit per parameter index changed since the
+    // last block, and the latest plain value of each. Cleared with stateLock held when a state is loaded.
+    std::atomic<uint64_t> dirtyParameters{0};
+    std::atomic<float> changedParameterValues[64]{};
+    // CPU budget governor. The load figures are audio thread only.
+    std::atomic<bool> governorEnabled{true};
+    std::atomic<double> governorBudget{AYUMI_GOVERNOR_DEFAULT_BUDGET};
+    std::atomic<int> qualityTier{AYUMI_QUALITY_FULL};
+    double governorLoad{0}; // smoothed processing time / block duration
+    double governorOverSeconds{0}; // audio time the load has stayed above the budget
+    double governorUnderSeconds{0}; // audio time the load has stayed below the step-up threshold
+   #if AYUMI_JUCE_INSTRUMENTATION
+    ProcessStats processStats{};
+   #endif
+   #if AYUMI_JUCE_TRACING
+    TraceRecorder trace{};
+   #endif
     // FIXME: we should remove dependency on JUCE and make plugin core implementation independent of JUCE...
     juce::NormalisableRange<float> mixerRange{0.0f, 8.0f, 1.0f};
     juce::NormalisableRange<float> volumeRange{0.0f, 14.0f, 1.0f}; // FIXME: max = 14?? 15 doesn't work
@@ -162,10 +313,37 @@ private:
     juce::NormalisableRange<float> softwareEnvelopeNumStopsRange{0.0f, 6.0f, 1.0f};
     juce::NormalisableRange<float> softwareEnvelopeStopSecondsRange{0.0f, 4096.0f, 0.01f, 0.2f}; // same as clock range so far
     juce::NormalisableRange<float> softwareEnvelopeStopRatioRange{0.0f, 1.0f};
+    juce::NormalisableRange<float> qualityTierRange{0.0f, (float) (AYUMI_QUALITY_TIERS - 1), 1.0f};
+    juce::NormalisableRange<float> lowLatencyRange{0.0f, 1.0f, 1.0f};
 
-    void setParametersFromState();
+    void setParametersFromState(const AyumiState& state);
+    void applyStateToEngine();
+    void applyPendingChanges();
+    void applyPreset(int index);
+    uint64_t storeChangedParameters(AyumiState& state, uint64_t dirty);
+    AyumiState copyState();
+    void timerCallback() override;
+    float getStateValue(const AyumiState& s, const ParameterDescriptor& d) const;
+    bool setStateValue(AyumiState& s, const ParameterDescriptor& d, float value);
+    void applyVolume(const ParameterDescriptor& d);
+    void applyPan(const ParameterDescriptor& d);
+    void applyEnvelope(const ParameterDescriptor& d);
+    void applyEnvelopeShape(const ParameterDescriptor& d);
+    void applyNoise(const ParameterDescriptor& d);
+    void applyClock(const ParameterDescriptor& d);
     void processFrames(juce::AudioBuffer<float>& buffer, int start, int end);
-    void ayumi_process_midi_event(juce::MidiMessage &msg);
+    void renderFrames(juce::AudioBuffer<float>& buffer, int start, int end);
+    void updateGovernor(juce::int64 startTicks, int numFrames);
+    bool syncRegisterLog();
+    void ayumi_process_midi_event(const uint8_t* bytes, int size);
+    void ayumi_process_ump_event(const uint32_t* ump);
+    void ayumi_process_sysex(const uint8_t* data, int size);
+    void ayumi_process_preset_event(const uint8_t* bytes);
+    void ayumi_apply_registers(const uint8_t* r);
+    void ayumi_write_register(int reg, uint8_t value);
+    void ayumi_apply_register_log();
+    void ayumi_restart_envelope(int shape);
+    void ayumi_capture_registers(int frameInBlock);
     void audioProcessorParameterChanged(AudioProcessor *processor, int parameterIndex, float newValue) override;
     void audioProcessorChanged(AudioProcessor *processor, const AudioProcessor::ChangeDetails &details) override;
 
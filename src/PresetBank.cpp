@@ -0,0 +1,58 @@
+/*
+  ==============================================================================
+
+    Preset bank: fixed-size plugin state records, for program switching.
+
+  ==============================================================================
+*/
+
+#include <string.h>
+#include "PresetBank.h"
+
+static uint32_t read_le32(const uint8_t* p) { return p[0] + (p[1] << 8) + (p[2] << 16) + ((uint32_t) p[3] << 24); }
+
+static void write_le32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        p[i] = (uint8_t) (v >> (i * 8));
+}
+
+bool PresetBank::open(const uint8_t* data, size_t size, size_t stateSize, const char** error) {
+    close();
+    *error = "Invalid preset bank";
+
+    if (size < PRESET_BANK_HEADER_SIZE || memcmp(data, "AAPB", 4) != 0)
+        return false;
+    if (read_le32(data + 4) != PRESET_BANK_VERSION || read_le32(data + 8) != stateSize) {
+        // the states are stored as they are in memory.
+        *error = "The preset bank was written by an incompatible build";
+        return false;
+    }
+    uint32_t count = read_le32(data + 12);
+    size_t recordSize = PRESET_BANK_NAME_SIZE + stateSize;
+    if (count > 0x7FFFFFFF || (size - PRESET_BANK_HEADER_SIZE) / recordSize < count)
+        return false;
+    // every name has to be terminated in its field. This touches every record as well, so that the pages of a
+    // mapped file are already resident when the audio thread switches programs.
+    const uint8_t* p = data + PRESET_BANK_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; i++, p += recordSize)
+        if (memchr(p, 0, PRESET_BANK_NAME_SIZE) == nullptr)
+            return false;
+
+    records = data + PRESET_BANK_HEADER_SIZE;
+    record_size = recordSize;
+    num_presets = (int) count;
+    return true;
+}
+
+void PresetBank::close() {
+    records = nullptr;
+    record_size = 0;
+    num_presets = 0;
+}
+
+void PresetBank::writeHeader(uint8_t* header, size_t stateSize, int numPresets) {
+    memcpy(header, "AAPB", 4);
+    write_le32(header + 4, PRESET_BANK_VERSION);
+    write_le32(header + 8, (uint32_t) stateSize);
+    write_le32(header + 12, (uint32_t) numPresets);
+}
@@ -0,0 +1,46 @@
+/*
+  ==============================================================================
+
+    Preset bank: fixed-size plugin state records, for program switching.
+
+    Like the register log player, it works on a byte span (typically a
+    memory-mapped file) and never copies it. A bank is a 16-byte header
+    ("AAPB", then the format version, the state size and the number of
+    records as little-endian 32-bit ints), followed by the records: a
+    NUL-terminated name in PRESET_BANK_NAME_SIZE bytes, then the state as it
+    is laid out in memory. Looking up a record is O(1), without any parsing.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PRESET_BANK_HEADER_SIZE 16
+#define PRESET_BANK_NAME_SIZE 32
+#define PRESET_BANK_VERSION 1
+
+class PresetBank
+{
+public:
+    // `data` is not copied; it must stay valid until close() (or another open()). `stateSize` is the size of the
+    // state the caller expects in the records. On failure, `error` points to a static message.
+    bool open(const uint8_t* data, size_t size, size_t stateSize, const char** error);
+    void close();
+
+    bool isOpen() const { return records != nullptr; }
+    int getNumPresets() const { return num_presets; }
+    // `index` must be in range.
+    const char* getName(int index) const { return (const char*) (records + (size_t) index * record_size); }
+    const uint8_t* getState(int index) const { return records + (size_t) index * record_size + PRESET_BANK_NAME_SIZE; }
+
+    // Fills in the header of a bank of `numPresets` records with `stateSize` bytes of state each.
+    static void writeHeader(uint8_t* header, size_t stateSize, int numPresets);
+
+private:
+    const uint8_t* records{nullptr};
+    size_t record_size{0};
+    int num_presets{0};
+};
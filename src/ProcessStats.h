@@ -0,0 +1,145 @@
+/*
+  ==============================================================================
+
+    Per-block processing statistics, compiled in only when
+    AYUMI_JUCE_INSTRUMENTATION is set (the AYUMI_JUCE_INSTRUMENTATION CMake
+    option). Otherwise AYUMI_STATS() expands to nothing and there is no cost.
+
+    The counters are written by the audio thread only (plain relaxed stores,
+    no read-modify-write), and can be read from any thread.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <juce_core/juce_core.h>
+
+#ifndef AYUMI_JUCE_INSTRUMENTATION
+#define AYUMI_JUCE_INSTRUMENTATION 0
+#endif
+
+#if AYUMI_JUCE_INSTRUMENTATION
+#define AYUMI_STATS(statement) statement
+#else
+#define AYUMI_STATS(statement)
+#endif
+
+class ProcessStats
+{
+public:
+    // Bucket 0 counts blocks that took less than 4us, bucket i (> 0) less than 4us << i,
+    // and the last one everything longer.
+    enum { NUM_BUCKETS = 16, FIRST_BUCKET_MICROSECONDS = 4 };
+
+    struct Totals {
+        juce::uint64 blocks;
+        juce::uint64 frames;
+        juce::uint64 subBlocks; // rendered runs between events
+        juce::uint64 midiEvents;
+        juce::uint64 chipTicks; // (clock rate / 8) ticks covered by the rendered runs
+        juce::uint64 firInvocations; // decimating FIR runs (one per frame per filtered channel)
+        juce::uint64 nanoseconds;
+        juce::uint64 maxNanoseconds;
+        juce::uint64 histogram[NUM_BUCKETS];
+    };
+
+    // audio thread only
+    juce::int64 beginBlock()
+    {
+        if (resetRequested.exchange(false, std::memory_order_acquire)) {
+            for (auto c : {&blocks, &frames, &subBlocks, &midiEvents, &chipTicks, &firInvocations, &nanoseconds,
+                           &maxNanoseconds})
+                c->store(0, std::memory_order_relaxed);
+            for (auto& b : histogram)
+                b.store(0, std::memory_order_relaxed);
+        }
+        return juce::Time::getHighResolutionTicks();
+    }
+
+    // audio thread only
+    void endBlock(juce::int64 startTicks, int numFrames)
+    {
+        auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+        auto elapsed = (juce::uint64) (seconds * 1e9);
+        add(blocks, 1);
+        add(frames, (juce::uint64) numFrames);
+        add(nanoseconds, elapsed);
+        if (elapsed > maxNanoseconds.load(std::memory_order_relaxed))
+            maxNanoseconds.store(elapsed, std::memory_order_relaxed);
+        int bucket = 0;
+        auto microseconds = elapsed / 1000;
+        while (bucket < NUM_BUCKETS - 1 && microseconds >= ((juce::uint64) FIRST_BUCKET_MICROSECONDS << bucket))
+            bucket++;
+        add(histogram[bucket], 1);
+    }
+
+    // audio thread only
+    void addSubBlock() { add(subBlocks, 1); }
+    void addMidiEvent() { add(midiEvents, 1); }
+    void addChipTicks(juce::uint64 n) { add(chipTicks, n); }
+    void addFirInvocations(juce::uint64 n) { add(firInvocations, n); }
+
+    // any thread. The counters are read one by one, so they may be off by a block with regard to each other.
+    Totals read() const
+    {
+        Totals t{};
+        t.blocks = blocks.load(std::memory_order_relaxed);
+        t.frames = frames.load(std::memory_order_relaxed);
+        t.subBlocks = subBlocks.load(std::memory_order_relaxed);
+        t.midiEvents = midiEvents.load(std::memory_order_relaxed);
+        t.chipTicks = chipTicks.load(std::memory_order_relaxed);
+        t.firInvocations = firInvocations.load(std::memory_order_relaxed);
+        t.nanoseconds = nanoseconds.load(std::memory_order_relaxed);
+        t.maxNanoseconds = maxNanoseconds.load(std::memory_order_relaxed);
+        for (int i = 0; i < NUM_BUCKETS; i++)
+            t.histogram[i] = histogram[i].load(std::memory_order_relaxed);
+        return t;
+    }
+
+    // any thread: the counters are cleared by the audio thread at the top of the next block.
+    void requestReset() { resetRequested.store(true, std::memory_order_release); }
+
+    // any thread: a human-readable dump of the current totals.
+    juce::String toString(double sampleRate) const
+    {
+        auto t = read();
+        auto audioSeconds = sampleRate > 0 ? (double) t.frames / sampleRate : 0.0;
+        auto cpuSeconds = (double) t.nanoseconds * 1e-9;
+        juce::String s;
+        s << "blocks: " << (juce::int64) t.blocks << ", frames: " << (juce::int64) t.frames
+          << ", sub-blocks: " << (juce::int64) t.subBlocks << ", MIDI events: " << (juce::int64) t.midiEvents << "\n"
+          << "chip ticks: " << (juce::int64) t.chipTicks << ", FIR invocations: " << (juce::int64) t.firInvocations
+          << "\n"
+          << "mean block: " << juce::String(t.blocks > 0 ? cpuSeconds * 1e6 / (double) t.blocks : 0.0, 1)
+          << "us, max block: " << juce::String((double) t.maxNanoseconds * 1e-3, 1) << "us, load: "
+          << juce::String(audioSeconds > 0 ? cpuSeconds / audioSeconds * 100 : 0.0, 2) << "%\n";
+        for (int i = 0; i < NUM_BUCKETS; i++) {
+            if (i < NUM_BUCKETS - 1)
+                s << "< " << (juce::int64) FIRST_BUCKET_MICROSECONDS * (1 << i) << "us: ";
+            else
+                s << ">= " << (juce::int64) FIRST_BUCKET_MICROSECONDS * (1 << (i - 1)) << "us: ";
+            s << (juce::int64) t.histogram[i] << "\n";
+        }
+        return s;
+    }
+
+private:
+    std::atomic<juce::uint64> blocks{0};
+    std::atomic<juce::uint64> frames{0};
+    std::atomic<juce::uint64> subBlocks{0};
+    std::atomic<juce::uint64> midiEvents{0};
+    std::atomic<juce::uint64> chipTicks{0};
+    std::atomic<juce::uint64> firInvocations{0};
+    std::atomic<juce::uint64> nanoseconds{0};
+    std::atomic<juce::uint64> maxNanoseconds{0};
+    std::atomic<juce::uint64> histogram[NUM_BUCKETS]{};
+    std::atomic<bool> resetRequested{false};
+
+    // single writer, so a load and a store are enough (and cheaper than fetch_add()).
+    static void add(std::atomic<juce::uint64>& counter, juce::uint64 n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
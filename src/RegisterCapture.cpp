@@ -0,0 +1,155 @@
+/*
+  ==============================================================================
+
+    Captures the effective chip register changes into a VGM file.
+
+  ==============================================================================
+*/
+
+#include "RegisterCapture.h"
+
+#define REGISTER_CAPTURE_RING_SIZE 65536
+#define REGISTER_CAPTURE_VGM_HEADER_SIZE 0x80
+#define REGISTER_CAPTURE_VGM_SAMPLE_RATE 44100
+
+RegisterCapture::RegisterCapture(const juce::File& file, int32_t clockRate, bool isYM, int32_t sampleRate)
+    : juce::Thread("ayumi register capture"), file(file), clock_rate(clockRate), is_ym(isYM), sample_rate(sampleRate),
+      fifo(REGISTER_CAPTURE_RING_SIZE), records(REGISTER_CAPTURE_RING_SIZE)
+{
+}
+
+RegisterCapture::~RegisterCapture()
+{
+    stop();
+}
+
+bool RegisterCapture::start(juce::String& error)
+{
+    file.deleteFile();
+    stream.reset(new juce::FileOutputStream(file));
+    if (!stream->openedOk()) {
+        error = "Cannot create " + file.getFullPathName();
+        stream.reset();
+        return false;
+    }
+    // the header is completed at stop().
+    for (int i = 0; i < REGISTER_CAPTURE_VGM_HEADER_SIZE; i++)
+        stream->writeByte(0);
+    startThread();
+    return true;
+}
+
+void RegisterCapture::stop()
+{
+    if (stream == nullptr || stopped)
+        return;
+    stopThread(1000);
+    drain();
+    stream->writeByte((char) 0x66); // end of sound data
+    writeHeader();
+    stream->flush();
+    stream.reset();
+    stopped = true;
+}
+
+void RegisterCapture::capture(int frameInBlock, const struct ayumi* ay, bool envelopeRestarted)
+{
+    // the register image of the current chip state
+    uint8_t r[14];
+    int mixer = 0;
+    for (int ch = 0; ch < TONE_CHANNELS; ch++) {
+        auto& c = ay->channels[ch];
+        r[ch * 2] = c.tone_period & 0xFF;
+        r[ch * 2 + 1] = c.tone_period >> 8;
+        mixer |= (c.t_off << ch) + (c.n_off << (ch + 3));
+        r[8 + ch] = c.volume + (c.e_on ? 0x10 : 0);
+    }
+    r[6] = ay->noise_period;
+    r[7] = mixer;
+    r[11] = ay->envelope_period & 0xFF;
+    r[12] = ay->envelope_period >> 8;
+    r[13] = ay->envelope_shape;
+
+    for (int i = 0; i < 14; i++) {
+        if (has_last && last[i] == r[i] && (i != 13 || !envelopeRestarted))
+            continue;
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(1, start1, size1, start2, size2);
+        if (size1 == 0) {
+            // keep `last` unchanged, so that the write is retried at the next call.
+            dropped++;
+            continue;
+        }
+        records[(size_t) start1] = {block_start + frameInBlock, (uint8_t) i, r[i]};
+        fifo.finishedWrite(1);
+        last[i] = r[i];
+    }
+    has_last = true;
+}
+
+void RegisterCapture::run()
+{
+    while (!threadShouldExit()) {
+        drain();
+        wait(20);
+    }
+}
+
+void RegisterCapture::drain()
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(fifo.getNumReady(), start1, size1, start2, size2);
+    auto write = [this](const Record& record) {
+        writeWait(record.frame * REGISTER_CAPTURE_VGM_SAMPLE_RATE / sample_rate - written_samples);
+        stream->writeByte((char) 0xA0); // AY8910 write
+        stream->writeByte((char) record.reg);
+        stream->writeByte((char) record.value);
+    };
+    for (int i = 0; i < size1; i++)
+        write(records[(size_t) (start1 + i)]);
+    for (int i = 0; i < size2; i++)
+        write(records[(size_t) (start2 + i)]);
+    fifo.finishedRead(size1 + size2);
+}
+
+void RegisterCapture::writeWait(juce::int64 samples)
+{
+    written_samples += samples > 0 ? samples : 0;
+    while (samples > 0) {
+        if (samples == 735 || samples == 882) {
+            stream->writeByte((char) (samples == 735 ? 0x62 : 0x63)); // 1/60 or 1/50 seconds
+            samples = 0;
+        } else if (samples <= 16) {
+            stream->writeByte((char) (0x70 + samples - 1));
+            samples = 0;
+        } else {
+            int n = (int) std::min(samples, (juce::int64) 65535);
+            stream->writeByte((char) 0x61);
+            stream->writeShort((short) n);
+            samples -= n;
+        }
+    }
+}
+
+void RegisterCapture::writeHeader()
+{
+    auto end = stream->getPosition();
+    stream->setPosition(0);
+    stream->write("Vgm ", 4);
+    stream->writeInt((int) (end - 4)); // EOF offset
+    stream->writeInt(0x171); // version
+    for (int offset = 0x0C; offset < 0x18; offset += 4)
+        stream->writeInt(0);
+    stream->writeInt((int) written_samples); // total samples
+    for (int offset = 0x1C; offset < 0x34; offset += 4)
+        stream->writeInt(0); // no loop, no other chips
+    stream->writeInt(REGISTER_CAPTURE_VGM_HEADER_SIZE - 0x34); // data offset
+    for (int offset = 0x38; offset < 0x74; offset += 4)
+        stream->writeInt(0);
+    stream->writeInt(clock_rate); // AY8910 clock
+    stream->writeByte((char) (is_ym ? 0x10 : 0x00)); // AY8910 type: YM2149 or AY8910
+    stream->writeByte(1); // AY8910 flags: legacy output
+    for (int offset = 0x7A; offset < REGISTER_CAPTURE_VGM_HEADER_SIZE; offset++)
+        stream->writeByte(0);
+    stream->setPosition(end);
+}
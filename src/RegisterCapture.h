@@ -0,0 +1,70 @@
+/*
+  ==============================================================================
+
+    Captures the effective chip register changes into a VGM file.
+
+    The audio thread compares the chip state with the last captured one and
+    pushes the changed registers into a preallocated lock-free ring; a
+    background thread drains it into the file.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <juce_core/juce_core.h>
+#include "ayumi.h"
+
+class RegisterCapture : private juce::Thread
+{
+public:
+    RegisterCapture(const juce::File& file, int32_t clockRate, bool isYM, int32_t sampleRate);
+    ~RegisterCapture() override;
+
+    // Creates the file and starts the writer thread.
+    bool start(juce::String& error);
+    // Stops the writer thread, writes everything remaining and completes the VGM header.
+    void stop();
+
+    // audio thread only: records the registers that changed since the last call, at `frameInBlock`.
+    // R13 is recorded also when the envelope was restarted with the same shape.
+    void capture(int frameInBlock, const struct ayumi* ay, bool envelopeRestarted);
+    // audio thread only: moves the time base to the next block.
+    void endBlock(int numFrames) { block_start += numFrames; }
+
+    // number of register writes lost because the ring was full.
+    juce::uint64 getNumDroppedWrites() const { return dropped.load(); }
+
+private:
+    struct Record {
+        juce::int64 frame;
+        uint8_t reg;
+        uint8_t value;
+    };
+
+    juce::File file;
+    int32_t clock_rate;
+    bool is_ym;
+    int32_t sample_rate;
+
+    // audio thread side
+    juce::int64 block_start{0};
+    uint8_t last[14]{};
+    bool has_last{false};
+
+    juce::AbstractFifo fifo;
+    std::vector<Record> records;
+    std::atomic<juce::uint64> dropped{0};
+
+    // writer thread side
+    std::unique_ptr<juce::FileOutputStream> stream{};
+    juce::int64 written_samples{0}; // in VGM samples (44100Hz)
+    bool stopped{false};
+
+    void run() override;
+    void drain();
+    void writeWait(juce::int64 samples);
+    void writeHeader();
+};
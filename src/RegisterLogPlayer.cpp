@@ -0,0 +1,322 @@
+/*
+  ==============================================================================
+
+    Streaming player for AY register logs (YM and VGM files).
+
+  ==============================================================================
+*/
+
+#include <algorithm>
+#include <string.h>
+#include "RegisterLogPlayer.h"
+
+#define VGM_SAMPLE_RATE 44100
+
+static uint32_t read_be32(const uint8_t* p) { return ((uint32_t) p[0] << 24) + (p[1] << 16) + (p[2] << 8) + p[3]; }
+static uint16_t read_be16(const uint8_t* p) { return (p[0] << 8) + p[1]; }
+static uint32_t read_le32(const uint8_t* p) { return p[0] + (p[1] << 8) + (p[2] << 16) + ((uint32_t) p[3] << 24); }
+static uint16_t read_le16(const uint8_t* p) { return p[0] + (p[1] << 8); }
+
+bool RegisterLogPlayer::open(const uint8_t* data, size_t size, const char** error) {
+    close();
+    *error = "Invalid or unsupported register log";
+
+    if (size >= 7 && memcmp(data + 2, "-lh5-", 5) == 0) {
+        // most YM files are distributed LHA-compressed.
+        *error = "LHA-compressed YM files are not supported (extract them first)";
+        return false;
+    }
+
+    if (size >= 4 && (memcmp(data, "YM3!", 4) == 0 || memcmp(data, "YM3b", 4) == 0)) {
+        // YM3: no header, 14 interleaved registers per frame, 2MHz at 50Hz. YM3b has a loop frame at the end.
+        bool hasLoop = data[3] == 'b';
+        if (size < (hasLoop ? 8 : 4))
+            return false;
+        frames = data + 4;
+        num_frames = (uint32_t) ((size - (hasLoop ? 8 : 4)) / 14);
+        loop_frame = hasLoop ? read_le32(data + size - 4) : 0;
+        frame_size = 14;
+        interleaved = true;
+        clock_rate = 2000000;
+        source_rate = 50;
+        format = FORMAT_YM;
+    } else if (size >= 34 && (memcmp(data, "YM5!", 4) == 0 || memcmp(data, "YM6!", 4) == 0)) {
+        if (memcmp(data + 4, "LeOnArD!", 8) != 0)
+            return false;
+        num_frames = read_be32(data + 12);
+        interleaved = read_be32(data + 16) & 1;
+        int numDigiDrums = read_be16(data + 20);
+        clock_rate = (int32_t) read_be32(data + 22);
+        source_rate = read_be16(data + 26);
+        loop_frame = read_be32(data + 28);
+        // skip the additional data, digidrum samples, and the song name, author and comment strings.
+        size_t offset = 34 + read_be16(data + 32);
+        for (int i = 0; i < numDigiDrums && offset + 4 <= size; i++)
+            offset += 4 + read_be32(data + offset);
+        for (int i = 0; i < 3 && offset < size; i++) {
+            auto end = (const uint8_t*) memchr(data + offset, 0, size - offset);
+            offset = end == nullptr ? size : end - data + 1;
+        }
+        if (offset + (uint64_t) num_frames * 16 > size || clock_rate <= 0 || source_rate == 0)
+            return false;
+        frames = data + offset;
+        frame_size = 16;
+        format = FORMAT_YM;
+    } else if (size >= 0x40 && memcmp(data, "Vgm ", 4) == 0) {
+        uint32_t version = read_le32(data + 8);
+        size_t dataOffset = version >= 0x150 && read_le32(data + 0x34) != 0 ? 0x34 + read_le32(data + 0x34) : 0x40;
+        // header fields beyond the data offset do not exist in the file.
+        uint32_t ayClock = version >= 0x151 && dataOffset >= 0x7A && size >= 0x7A ? read_le32(data + 0x74) : 0;
+        if ((ayClock & 0x3FFFFFFF) == 0) {
+            *error = "The VGM file does not contain AY8910 data";
+            return false;
+        }
+        uint8_t ayType = data[0x78];
+        uint8_t ayFlags = data[0x79];
+        // 0x: AY-3-891x, 1x: YM2149 and compatibles, which can have an internal clock divider (pin 26).
+        is_ym = ayType >= 0x10;
+        clock_rate = (int32_t) (ayClock & 0x3FFFFFFF);
+        if (is_ym && (ayFlags & 0x10))
+            clock_rate /= 2;
+        source_rate = VGM_SAMPLE_RATE;
+        length = read_le32(data + 0x18);
+        loop_offset = read_le32(data + 0x1C) != 0 ? 0x1C + read_le32(data + 0x1C) : 0;
+        commands_start = dataOffset;
+        commands_end = std::min(size, (size_t) read_le32(data + 4) + 4);
+        if (commands_start >= commands_end)
+            return false;
+        if (loop_offset < commands_start || loop_offset >= commands_end)
+            loop_offset = 0;
+        format = FORMAT_VGM;
+    } else
+        return false;
+
+    if (format == FORMAT_YM) {
+        is_ym = true;
+        length = num_frames;
+        if (num_frames == 0)
+            format = FORMAT_NONE;
+    }
+    if (!isOpen())
+        return false;
+
+    this->data = data;
+    this->size = size;
+    buildSeekIndex();
+    *error = nullptr;
+    return true;
+}
+
+void RegisterLogPlayer::close() {
+    data = nullptr;
+    size = 0;
+    format = FORMAT_NONE;
+    is_ym = true;
+    clock_rate = 2000000;
+    source_rate = 50;
+    length = 0;
+    frames = nullptr;
+    num_frames = loop_frame = 0;
+    commands_start = commands_end = loop_offset = 0;
+    seek_index.clear();
+    seek_loop_start = 0;
+    seek_loop_period = 0;
+    rewind();
+}
+
+void RegisterLogPlayer::rewind() {
+    finished = !isOpen();
+    cursor = format == FORMAT_VGM ? commands_start : 0;
+    next_time = 0;
+    position = 0;
+    memset(registers, 0, sizeof(registers));
+    // everything but R13 is "written" as the initial (zero) state, so that a seek restores all of them.
+    written = (1 << 13) - 1;
+}
+
+RegisterLogPlayer::State RegisterLogPlayer::getState() const {
+    State state{cursor, next_time, position, finished, {}, written};
+    memcpy(state.registers, registers, sizeof(registers));
+    return state;
+}
+
+void RegisterLogPlayer::setState(const State& state) {
+    cursor = state.cursor;
+    next_time = state.next_time;
+    position = state.position;
+    finished = state.finished || !isOpen();
+    memcpy(registers, state.registers, sizeof(registers));
+    written = state.written;
+}
+
+// Walks the log once with looping enabled, up to its second loop jump (or its end).
+// From the first jump on, every register holds its last write in the loop body (or its value from before
+// the loop if the loop never writes it), so all the repeats run through the same states as the first one.
+void RegisterLogPlayer::buildSeekIndex() {
+    bool wasLooping = looping;
+    looping = true;
+    seek_index.clear();
+    seek_loop_start = 0;
+    seek_loop_period = 0;
+    rewind();
+    int64_t firstJump = -1;
+    for (int64_t steps = 0; !finished; steps++) {
+        if (steps % REGISTER_LOG_SEEK_INTERVAL == 0)
+            seek_index.push_back(getState());
+        size_t previousCursor = cursor;
+        int64_t time = next_time;
+        step();
+        if (finished || cursor > previousCursor)
+            continue;
+        // the cursor only moves back on a loop jump.
+        if (firstJump < 0) {
+            firstJump = time;
+            seek_loop_start = seek_index.size();
+            steps = -1; // the next entry is the first state after the jump.
+        } else {
+            seek_loop_period = time - firstJump;
+            break;
+        }
+    }
+    if (firstJump < 0)
+        seek_loop_start = seek_index.size();
+    looping = wasLooping;
+    rewind();
+}
+
+void RegisterLogPlayer::seek(int64_t frame) {
+    rewind();
+    // the last entry strictly before `frame`: the writes at `frame` itself are left to the next process().
+    int64_t shift = 0;
+    auto before = [&](const State& state) { return frameAt(state.next_time + shift) < frame; };
+    // without looping, the entries after the loop jump do not apply.
+    auto last = looping ? seek_index.end() : seek_index.begin() + seek_loop_start;
+    auto found = std::partition_point(seek_index.begin(), last, before);
+    if (looping && seek_loop_period > 0 && found == last && seek_loop_start < seek_index.size()) {
+        // beyond the indexed range: the same entry in a later repeat of the loop.
+        auto loopBegin = seek_index.begin() + seek_loop_start;
+        int64_t repeats = (frame * source_rate / sample_rate - loopBegin->next_time) / seek_loop_period + 1;
+        for (; repeats > 0; repeats--) {
+            shift = repeats * seek_loop_period;
+            auto repeated = std::partition_point(loopBegin, seek_index.end(), before);
+            if (repeated != loopBegin) {
+                found = repeated;
+                break;
+            }
+        }
+        if (repeats <= 0)
+            shift = 0;
+    }
+    if (found != seek_index.begin()) {
+        State state = *(found - 1);
+        state.next_time += shift;
+        state.position = frameAt(state.next_time);
+        setState(state);
+    }
+    while (position < frame)
+        process((int) std::min(frame - position, (int64_t) INT32_MAX));
+}
+
+int RegisterLogPlayer::process(int maxFrames) {
+    if (maxFrames <= 0)
+        return 0;
+    while (!finished && frameAt(next_time) <= position)
+        step();
+    int64_t n = finished ? maxFrames : std::min((int64_t) maxFrames, frameAt(next_time) - position);
+    position += n;
+    return (int) n;
+}
+
+void RegisterLogPlayer::write(int reg, uint8_t value) {
+    if (reg == 13 || registers[reg] != value)
+        written |= 1 << reg;
+    registers[reg] = value;
+}
+
+void RegisterLogPlayer::step() {
+    if (format == FORMAT_YM)
+        stepYM();
+    else
+        stepVGM();
+}
+
+void RegisterLogPlayer::stepYM() {
+    for (int r = 0; r < REGISTER_LOG_NUM_REGISTERS; r++) {
+        uint8_t value = interleaved ? frames[(size_t) r * num_frames + cursor] : frames[cursor * frame_size + r];
+        if (r == 13 && value == 0xFF)
+            continue; // no write (the envelope is not restarted)
+        write(r, value);
+    }
+    next_time++;
+    if (++cursor >= num_frames) {
+        if (looping && loop_frame < num_frames)
+            cursor = loop_frame;
+        else
+            finished = true;
+    }
+}
+
+// Returns the length of the VGM command at `p`, or 0 if it is unknown or truncated.
+static size_t vgm_command_length(const uint8_t* p, size_t available) {
+    uint8_t cmd = p[0];
+    size_t len = 0;
+    if (cmd == 0x67)
+        len = available >= 7 ? 7 + (size_t) read_le32(p + 3) : 0; // data block
+    else if (cmd == 0x68)
+        len = 12;
+    else if (cmd == 0x62 || cmd == 0x63 || cmd == 0x66 || (cmd >= 0x70 && cmd <= 0x8F))
+        len = 1;
+    else if ((cmd >= 0x30 && cmd <= 0x3F) || cmd == 0x4F || cmd == 0x50 || cmd == 0x94)
+        len = 2;
+    else if ((cmd >= 0x40 && cmd <= 0x4E) || (cmd >= 0x51 && cmd <= 0x5F) || cmd == 0x61 || (cmd >= 0xA0 && cmd <= 0xBF))
+        len = 3;
+    else if (cmd >= 0xC0 && cmd <= 0xDF)
+        len = 4;
+    else if (cmd >= 0xE0 || cmd == 0x90 || cmd == 0x91 || cmd == 0x95)
+        len = 5;
+    else if (cmd == 0x92)
+        len = 6;
+    else if (cmd == 0x93)
+        len = 11;
+    return len <= available ? len : 0;
+}
+
+// Runs the commands until the next wait (or the end of the stream).
+void RegisterLogPlayer::stepVGM() {
+    bool looped = false;
+    while (true) {
+        size_t len = cursor < commands_end ? vgm_command_length(data + cursor, commands_end - cursor) : 0;
+        const uint8_t* p = data + cursor;
+        if (len == 0 || p[0] == 0x66) {
+            // end of data. A loop without any wait would never advance, so it ends the playback too.
+            if (looping && loop_offset != 0 && !looped) {
+                cursor = loop_offset;
+                looped = true;
+                continue;
+            }
+            finished = true;
+            return;
+        }
+        cursor += len;
+
+        int64_t wait = 0;
+        if (p[0] == 0xA0) {
+            // the top bit of the register number is for the second chip, which we do not have.
+            if (p[1] < REGISTER_LOG_NUM_REGISTERS)
+                write(p[1], p[2]);
+        } else if (p[0] == 0x61)
+            wait = read_le16(p + 1);
+        else if (p[0] == 0x62)
+            wait = 735;
+        else if (p[0] == 0x63)
+            wait = 882;
+        else if (p[0] >= 0x70 && p[0] <= 0x7F)
+            wait = (p[0] & 0xF) + 1;
+        else if (p[0] >= 0x80 && p[0] <= 0x8F)
+            wait = p[0] & 0xF;
+        if (wait > 0) {
+            next_time += wait;
+            return;
+        }
+    }
+}
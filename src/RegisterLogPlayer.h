@@ -0,0 +1,128 @@
+/*
+  ==============================================================================
+
+    Streaming player for AY register logs (YM and VGM files).
+
+    It works on a byte span (typically a memory-mapped file) and never copies
+    or decodes it up front; frames and commands are decoded as the playback
+    position reaches them. The register writes go into a register file that
+    the caller applies to the chip.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define REGISTER_LOG_NUM_REGISTERS 14
+// steps (YM frames / VGM waits) between two seek index entries, i.e. the most a seek replays.
+#define REGISTER_LOG_SEEK_INTERVAL 256
+
+class RegisterLogPlayer
+{
+public:
+    enum Format {
+        FORMAT_NONE,
+        FORMAT_YM, // YM3!, YM3b, YM5! and YM6! (uncompressed)
+        FORMAT_VGM // AY8910 commands in uncompressed VGM (not VGZ)
+    };
+
+    // `data` is not copied; it must stay valid until close() (or another open()).
+    // On failure, `error` points to a static message.
+    // The whole log is walked once here to build the seek index, which is the only allocation;
+    // open() (and copying the player) is not for the audio thread.
+    bool open(const uint8_t* data, size_t size, const char** error);
+    void close();
+
+    Format getFormat() const { return format; }
+    bool isOpen() const { return format != FORMAT_NONE; }
+    // true if the log targets YM2149 (or compatible) rather than AY-3-8910.
+    bool isYM() const { return is_ym; }
+    int32_t getClockRate() const { return clock_rate; }
+    double getLengthInSeconds() const { return (double) length / source_rate; }
+
+    void setSampleRate(int32_t sampleRate) { sample_rate = sampleRate; }
+    // If enabled, playback continues from the loop point (YM loop frame / VGM loop offset) at the end.
+    void setLooping(bool enabled) { looping = enabled; }
+    bool isFinished() const { return finished; }
+    // current position in output frames.
+    int64_t getPosition() const { return position; }
+
+    // Moves to `frame` (in output frames). The register file is restored from the nearest seek index entry
+    // and the writes after it are replayed (at most REGISTER_LOG_SEEK_INTERVAL steps), so that
+    // takeWrittenRegisters() reports everything needed to restore the chip at that position.
+    void seek(int64_t frame);
+
+    // Performs the register writes due at the current position, then advances up to `maxFrames` output frames,
+    // stopping right before the next write. Returns the number of frames advanced (at least 1 if maxFrames > 0).
+    int process(int maxFrames);
+
+    // Playback position and register file, for snapshots (the log itself is not included).
+    struct State {
+        size_t cursor;
+        int64_t next_time;
+        int64_t position;
+        bool finished;
+        uint8_t registers[REGISTER_LOG_NUM_REGISTERS];
+        uint16_t written;
+    };
+    State getState() const;
+    void setState(const State& state);
+
+    const uint8_t* getRegisters() const { return registers; }
+    // Returns the set of registers written since the last call (bit n for Rn) and clears it.
+    // R13 is reported on every write (even with the same value), as it restarts the envelope.
+    uint16_t takeWrittenRegisters() {
+        uint16_t ret = written;
+        written = 0;
+        return ret;
+    }
+
+private:
+    const uint8_t* data{nullptr};
+    size_t size{0};
+    Format format{FORMAT_NONE};
+    bool is_ym{true};
+    int32_t clock_rate{2000000};
+    int32_t source_rate{50}; // YM: frames per second, VGM: 44100 (samples per second)
+    int64_t length{0}; // in source units
+
+    // YM: frame data
+    const uint8_t* frames{nullptr};
+    uint32_t num_frames{0};
+    uint32_t loop_frame{0};
+    int frame_size{16}; // registers per frame in the file
+    bool interleaved{true};
+    // VGM: command stream
+    size_t commands_start{0};
+    size_t commands_end{0};
+    size_t loop_offset{0}; // 0 if there is no loop
+
+    int32_t sample_rate{44100};
+    bool looping{false};
+    bool finished{false};
+    size_t cursor{0}; // YM: next frame, VGM: offset of the next command
+    int64_t next_time{0}; // time of the next write, in source units
+    int64_t position{0};
+    uint8_t registers[REGISTER_LOG_NUM_REGISTERS]{};
+    uint16_t written{0};
+
+    // Seek index: the state every REGISTER_LOG_SEEK_INTERVAL steps over the first pass and the first repeat
+    // of the loop. Later repeats are the same as the first one, shifted by loop_period.
+    std::vector<State> seek_index{};
+    size_t seek_loop_start{0}; // first entry after the first loop jump (the size if there is none)
+    int64_t seek_loop_period{0}; // in source units, 0 if the log does not loop (or never waits in the loop)
+
+    int64_t frameAt(int64_t time) const {
+        return (time * sample_rate + source_rate - 1) / source_rate;
+    }
+    void write(int reg, uint8_t value);
+    void rewind();
+    void buildSeekIndex();
+    void step();
+    void stepYM();
+    void stepVGM();
+};
@@ -0,0 +1,129 @@
+/*
+  ==============================================================================
+
+    Records a timeline of the processing as a Chrome trace JSON file.
+
+  ==============================================================================
+*/
+
+#include <algorithm>
+#include "TraceRecorder.h"
+
+#define TRACE_RECORDER_RING_SIZE 16384
+
+TraceRecorder::TraceRecorder()
+    : juce::Thread("ayumi trace writer"), fifo(TRACE_RECORDER_RING_SIZE), records(TRACE_RECORDER_RING_SIZE)
+{
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    stop();
+}
+
+bool TraceRecorder::start(const juce::File& file, juce::String& error)
+{
+    stop();
+    file.deleteFile();
+    stream.reset(new juce::FileOutputStream(file));
+    if (!stream->openedOk()) {
+        error = "Cannot create " + file.getFullPathName();
+        stream.reset();
+        return false;
+    }
+    fifo.reset();
+    dropped = 0;
+    threads.clear();
+    threads.reserve(16);
+    first = true;
+    origin = juce::Time::getHighResolutionTicks();
+    // JSON array format; the closing bracket is written at stop(), but the viewers accept a file without it.
+    stream->writeText("[", false, false, nullptr);
+    startThread();
+    recording = true;
+    return true;
+}
+
+void TraceRecorder::stop()
+{
+    if (stream == nullptr)
+        return;
+    recording = false;
+    {
+        // wait for a record being pushed right now.
+        const juce::SpinLock::ScopedLockType lock{writerLock};
+    }
+    stopThread(1000);
+    drain();
+    stream->writeText("\n]\n", false, false, nullptr);
+    stream->flush();
+    stream.reset();
+}
+
+void TraceRecorder::push(const char* name, char phase, juce::int64 start, juce::int64 end, const char* arg0Name,
+                         int arg0, const char* arg1Name, int arg1)
+{
+    if (!recording.load(std::memory_order_relaxed))
+        return;
+    const juce::SpinLock::ScopedTryLockType lock{writerLock};
+    if (!lock.isLocked() || !recording.load(std::memory_order_relaxed)) {
+        dropped++;
+        return;
+    }
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(1, start1, size1, start2, size2);
+    if (size1 == 0) {
+        dropped++;
+        return;
+    }
+    records[(size_t) start1] = {start, end, name, {arg0Name, arg1Name}, {arg0, arg1},
+                                (juce::pointer_sized_int) juce::Thread::getCurrentThreadId(), phase};
+    fifo.finishedWrite(1);
+}
+
+void TraceRecorder::run()
+{
+    while (!threadShouldExit()) {
+        drain();
+        wait(20);
+    }
+}
+
+void TraceRecorder::drain()
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(fifo.getNumReady(), start1, size1, start2, size2);
+    for (int i = 0; i < size1; i++)
+        write(records[(size_t) (start1 + i)]);
+    for (int i = 0; i < size2; i++)
+        write(records[(size_t) (start2 + i)]);
+    fifo.finishedRead(size1 + size2);
+}
+
+void TraceRecorder::write(const Record& record)
+{
+    auto index = std::find(threads.begin(), threads.end(), record.thread) - threads.begin();
+    if (index == (juce::int64) threads.size())
+        threads.push_back(record.thread);
+    auto microseconds = [this](juce::int64 ticks) {
+        return juce::String(juce::Time::highResolutionTicksToSeconds(ticks - origin) * 1e6, 3);
+    };
+
+    juce::String s;
+    s << (first ? "\n" : ",\n") << "{\"name\":\"" << record.name << "\",\"ph\":\"" << (record.phase == 'X' ? "X" : "i")
+      << "\",\"ts\":" << microseconds(record.start);
+    if (record.phase == 'X')
+        s << ",\"dur\":" << juce::String(juce::Time::highResolutionTicksToSeconds(record.end - record.start) * 1e6, 3);
+    else
+        s << ",\"s\":\"t\"";
+    s << ",\"pid\":1,\"tid\":" << (int) index + 1;
+    if (record.argNames[0] != nullptr) {
+        s << ",\"args\":{\"" << record.argNames[0] << "\":" << record.args[0];
+        if (record.argNames[1] != nullptr)
+            s << ",\"" << record.argNames[1] << "\":" << record.args[1];
+        s << "}";
+    }
+    s << "}";
+    stream->writeText(s, false, false, nullptr);
+    first = false;
+}
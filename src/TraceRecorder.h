@@ -0,0 +1,125 @@
+/*
+  ==============================================================================
+
+    Records a timeline of the processing (blocks, event splits, MIDI events,
+    parameter changes) as a Chrome trace JSON file, which can be opened in
+    Perfetto (ui.perfetto.dev) or chrome://tracing.
+
+    Compiled in only when AYUMI_JUCE_TRACING is set (the AYUMI_JUCE_TRACING
+    CMake option); otherwise AYUMI_TRACE_SCOPE() and AYUMI_TRACE_INSTANT()
+    expand to nothing.
+
+    Any thread writes fixed-size records into a preallocated lock-free ring
+    (a record is dropped if the ring is full, or if another thread is writing
+    one at that moment); a background thread drains it into the file.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <juce_core/juce_core.h>
+
+#ifndef AYUMI_JUCE_TRACING
+#define AYUMI_JUCE_TRACING 0
+#endif
+
+#define AYUMI_TRACE_CONCAT_(a, b) a##b
+#define AYUMI_TRACE_CONCAT(a, b) AYUMI_TRACE_CONCAT_(a, b)
+#if AYUMI_JUCE_TRACING
+// a span from here to the end of the scope: (recorder, name[, arg0Name, arg0[, arg1Name, arg1]])
+#define AYUMI_TRACE_SCOPE(recorder, ...) TraceScope AYUMI_TRACE_CONCAT(traceScope, __LINE__){recorder, __VA_ARGS__}
+// a point in time: (recorder, name[, arg0Name, arg0[, arg1Name, arg1]])
+#define AYUMI_TRACE_INSTANT(recorder, ...) (recorder).instant(__VA_ARGS__)
+#else
+#define AYUMI_TRACE_SCOPE(recorder, ...)
+#define AYUMI_TRACE_INSTANT(recorder, ...)
+#endif
+
+class TraceRecorder : private juce::Thread
+{
+public:
+    TraceRecorder();
+    ~TraceRecorder() override;
+
+    // Creates the file and starts the writer thread. Not to be called concurrently with stop().
+    bool start(const juce::File& file, juce::String& error);
+    // Stops recording, writes everything remaining and completes the file.
+    void stop();
+
+    bool isRecording() const { return recording.load(std::memory_order_relaxed); }
+
+    // any thread, realtime-safe. Names must be string literals (only the pointers are recorded).
+    void complete(const char* name, juce::int64 startTicks, const char* arg0Name = nullptr, int arg0 = 0,
+                  const char* arg1Name = nullptr, int arg1 = 0)
+    {
+        push(name, 'X', startTicks, juce::Time::getHighResolutionTicks(), arg0Name, arg0, arg1Name, arg1);
+    }
+
+    void instant(const char* name, const char* arg0Name = nullptr, int arg0 = 0, const char* arg1Name = nullptr,
+                 int arg1 = 0)
+    {
+        auto now = juce::Time::getHighResolutionTicks();
+        push(name, 'i', now, now, arg0Name, arg0, arg1Name, arg1);
+    }
+
+    // number of records lost because the ring was full or busy.
+    juce::uint64 getNumDroppedRecords() const { return dropped.load(); }
+
+private:
+    struct Record {
+        juce::int64 start;
+        juce::int64 end;
+        const char* name;
+        const char* argNames[2];
+        int args[2];
+        juce::pointer_sized_int thread;
+        char phase;
+    };
+
+    std::atomic<bool> recording{false};
+    juce::SpinLock writerLock{}; // for the producers
+    juce::AbstractFifo fifo;
+    std::vector<Record> records;
+    std::atomic<juce::uint64> dropped{0};
+
+    // writer thread side
+    std::unique_ptr<juce::FileOutputStream> stream{};
+    juce::int64 origin{0};
+    bool first{true};
+    std::vector<juce::pointer_sized_int> threads{}; // trace thread ids are indices to this + 1
+
+    void push(const char* name, char phase, juce::int64 start, juce::int64 end, const char* arg0Name, int arg0,
+              const char* arg1Name, int arg1);
+    void run() override;
+    void drain();
+    void write(const Record& record);
+};
+
+#if AYUMI_JUCE_TRACING
+class TraceScope
+{
+public:
+    TraceScope(TraceRecorder& recorder, const char* name, const char* arg0Name = nullptr, int arg0 = 0,
+               const char* arg1Name = nullptr, int arg1 = 0)
+        : recorder(recorder), name(name), argNames{arg0Name, arg1Name}, args{arg0, arg1},
+          start(recorder.isRecording() ? juce::Time::getHighResolutionTicks() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (start != 0)
+            recorder.complete(name, start, argNames[0], args[0], argNames[1], args[1]);
+    }
+
+private:
+    TraceRecorder& recorder;
+    const char* name;
+    const char* argNames[2];
+    int args[2];
+    juce::int64 start;
+};
+#endif
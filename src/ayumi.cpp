@@ -1,5 +1,6 @@
 /* Author: Peter Sovietov */
 
+#include <stddef.h>
 #include <string.h>
 #include <math.h>
 #include "ayumi.h"
@@ -141,11 +142,36 @@ static void update_mixer(struct ayumi* ay) {
   }
 }
 
+static void update_mixer_mono(struct ayumi* ay) {
+  int i;
+  int out;
+  int noise = update_noise(ay);
+  int envelope = update_envelope(ay);
+  ay->left = 0;
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    out = (update_tone(ay, i) | ay->channels[i].t_off) & (noise | ay->channels[i].n_off);
+    out *= ay->channels[i].e_on ? envelope : ay->channels[i].volume * 2 + 1;
+    ay->left += ay->dac_table[out] * (ay->channels[i].pan_left + ay->channels[i].pan_right) * 0.5;
+  }
+}
+
+static void update_mixer_stems(struct ayumi* ay, double* left, double* right) {
+  int i;
+  int out;
+  int noise = update_noise(ay);
+  int envelope = update_envelope(ay);
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    out = (update_tone(ay, i) | ay->channels[i].t_off) & (noise | ay->channels[i].n_off);
+    out *= ay->channels[i].e_on ? envelope : ay->channels[i].volume * 2 + 1;
+    left[i] = ay->dac_table[out] * ay->channels[i].pan_left;
+    right[i] = ay->dac_table[out] * ay->channels[i].pan_right;
+  }
+}
+
 int ayumi_configure(struct ayumi* ay, int is_ym, double clock_rate, int sr) {
   int i;
   memset(ay, 0, sizeof(struct ayumi));
-  ay->step = clock_rate / (sr * 8 * DECIMATE_FACTOR);
-  ay->dac_table = is_ym ? YM_dac_table : AY_dac_table;
+  ayumi_reconfigure(ay, NULL, is_ym, clock_rate, sr);
   ay->noise = 1;
   ayumi_set_envelope(ay, 1);
   for (i = 0; i < TONE_CHANNELS; i += 1) {
@@ -154,6 +180,50 @@ int ayumi_configure(struct ayumi* ay, int is_ym, double clock_rate, int sr) {
   return ay->step < 1;
 }
 
+/* The FIR history at the old rate cannot be reused, so it is filled with the current interpolator level; a steady
+   signal goes on without a click. The stems (if any) are filled with their own levels, as they share fir_index. */
+static void change_decimate_factor(struct ayumi* ay, struct ayumi_stem* stems, int factor) {
+  int i;
+  int j;
+  if (ay->decimate_factor == factor) {
+    return;
+  }
+  for (i = 0; i < FIR_SIZE * 2; i += 1) {
+    ay->fir_left[i] = ay->interpolator_left.c[0];
+    ay->fir_right[i] = ay->interpolator_right.c[0];
+  }
+  for (j = 0; stems != NULL && j < TONE_CHANNELS; j += 1) {
+    for (i = 0; i < FIR_SIZE * 2; i += 1) {
+      stems[j].fir_left[i] = stems[j].interpolator_left.c[0];
+      stems[j].fir_right[i] = stems[j].interpolator_right.c[0];
+    }
+  }
+  ay->fir_index = 0;
+  ay->decimate_factor = factor;
+}
+
+int ayumi_reconfigure(struct ayumi* ay, struct ayumi_stem* stems, int is_ym, double clock_rate, int sr) {
+  int factor = DECIMATE_FACTOR;
+  /* the interpolator then runs at about the same step as at 44.1-48kHz with DECIMATE_FACTOR, at a fraction of
+     the cost at high output rates */
+  while (factor > MIN_DECIMATE_FACTOR && clock_rate / (sr * 8 * (factor / 2)) < 1) {
+    factor /= 2;
+  }
+  change_decimate_factor(ay, stems, factor);
+  ay->step = clock_rate / (sr * 8 * factor);
+  ay->dac_table = is_ym ? YM_dac_table : AY_dac_table;
+  return ay->step < 1;
+}
+
+int ayumi_set_decimate_factor(struct ayumi* ay, struct ayumi_stem* stems, int factor) {
+  if (factor != 2 && factor != 4 && factor != 8) {
+    return 0;
+  }
+  ay->step = ay->step * ay->decimate_factor / factor;
+  change_decimate_factor(ay, stems, factor);
+  return ay->step < 1;
+}
+
 void ayumi_set_pan(struct ayumi* ay, int index, double pan, int is_eqp) {
   if (is_eqp) {
     ay->channels[index].pan_left = sqrt(1 - pan);
@@ -285,6 +355,415 @@ static double decimate(double* x) {
   return y;
 }
 
+/* Shorter windowed-sinc (Kaiser) decimators for the lower quality tiers, centered on the same tap as decimate(),
+   and the three tiers for 4x and 2x oversampling (generated by tools/ayumi-fir/design_decimators.py) */
+static double decimate_63(double* x) {
+  double y = -9.556676936473834e-05 * (x[65] + x[127]) +
+    -0.00027063009205431166 * (x[66] + x[126]) +
+    -0.000510247393678345 * (x[67] + x[125]) +
+    -0.0007642185582034547 * (x[68] + x[124]) +
+    -0.0009468160393177265 * (x[69] + x[123]) +
+    -0.0009481858855358965 * (x[70] + x[122]) +
+    -0.0006581931399963885 * (x[71] + x[121]) +
+    0.0010330166923270237 * (x[73] + x[119]) +
+    0.0023462894791276877 * (x[74] + x[118]) +
+    0.003729414644548933 * (x[75] + x[117]) +
+    0.004866846494641192 * (x[76] + x[116]) +
+    0.005378886287364601 * (x[77] + x[115]) +
+    0.004891663187412561 * (x[78] + x[114]) +
+    0.00312746990133661 * (x[79] + x[113]) +
+    -0.004305522601120463 * (x[81] + x[111]) +
+    -0.009288154905878244 * (x[82] + x[110]) +
+    -0.014140099501518788 * (x[83] + x[109]) +
+    -0.017817609004658997 * (x[84] + x[108]) +
+    -0.019171558097387353 * (x[85] + x[107]) +
+    -0.017122779334952327 * (x[86] + x[106]) +
+    -0.01085612247022804 * (x[87] + x[105]) +
+    0.01524313219017187 * (x[89] + x[103]) +
+    0.03404448470525544 * (x[90] + x[102]) +
+    0.05499230519121435 * (x[91] + x[101]) +
+    0.07623235865652384 * (x[92] + x[100]) +
+    0.09568948543598203 * (x[93] + x[99]) +
+    0.11133864668977134 * (x[94] + x[98]) +
+    0.12148339752084031 * (x[95] + x[97]) +
+    0.12499661343475468 * x[96];
+  memcpy(&x[FIR_SIZE - DECIMATE_FACTOR], x, DECIMATE_FACTOR * sizeof(double));
+  return y;
+}
+
+static double decimate_31(double* x) {
+  double y = -0.0021759854764779813 * (x[81] + x[111]) +
+    -0.005340129604844295 * (x[82] + x[110]) +
+    -0.009028715897810152 * (x[83] + x[109]) +
+    -0.012408300313573404 * (x[84] + x[108]) +
+    -0.014356622399318711 * (x[85] + x[107]) +
+    -0.013630886144740187 * (x[86] + x[106]) +
+    -0.009100158831384837 * (x[87] + x[105]) +
+    0.013843396705643737 * (x[89] + x[103]) +
+    0.03187188065587984 * (x[90] + x[102]) +
+    0.05277665246987948 * (x[91] + x[101]) +
+    0.0746193317052618 * (x[92] + x[100]) +
+    0.09508161536843117 * (x[93] + x[99]) +
+    0.11180460628679904 * (x[94] + x[98]) +
+    0.12275802760164356 * (x[95] + x[97]) +
+    0.12657057574922193 * x[96];
+  memcpy(&x[FIR_SIZE - DECIMATE_FACTOR], x, DECIMATE_FACTOR * sizeof(double));
+  return y;
+}
+
+static double decimate_4x_95(double* x) {
+  double y = -1.9901937220460268e-05 * (x[1] + x[95]) +
+    -4.529743995107599e-05 * (x[2] + x[94]) +
+    -4.801635202226611e-05 * (x[3] + x[93]) +
+    9.462267776736804e-05 * (x[5] + x[91]) +
+    0.0001795832159975896 * (x[6] + x[90]) +
+    0.00016669454764343017 * (x[7] + x[89]) +
+    -0.00027264560368463615 * (x[9] + x[87]) +
+    -0.0004827751301568124 * (x[10] + x[86]) +
+    -0.0004224300860152376 * (x[11] + x[85]) +
+    0.0006276489266062918 * (x[13] + x[83]) +
+    0.0010679487942363297 * (x[14] + x[82]) +
+    0.000901684629674886 * (x[15] + x[81]) +
+    -0.0012599032954022627 * (x[17] + x[79]) +
+    -0.0020873831094418544 * (x[18] + x[78]) +
+    -0.0017199847802437085 * (x[19] + x[77]) +
+    0.002302477526508938 * (x[21] + x[75]) +
+    0.003743497453588022 * (x[22] + x[74]) +
+    0.0030317332521704802 * (x[23] + x[73]) +
+    -0.00393747866679361 * (x[25] + x[71]) +
+    -0.006318584212756686 * (x[26] + x[70]) +
+    -0.005057468260537462 * (x[27] + x[69]) +
+    0.006442023983478727 * (x[29] + x[67]) +
+    0.010259448599440344 * (x[30] + x[66]) +
+    0.008162010944824041 * (x[31] + x[65]) +
+    -0.010323433036615377 * (x[33] + x[63]) +
+    -0.01643157758958062 * (x[34] + x[62]) +
+    -0.01309573158803105 * (x[35] + x[61]) +
+    0.01677115265742596 * (x[37] + x[59]) +
+    0.027015933217542212 * (x[38] + x[58]) +
+    0.021903401407325978 * (x[39] + x[57]) +
+    -0.029683999601856588 * (x[41] + x[55]) +
+    -0.050030020746904755 * (x[42] + x[54]) +
+    -0.04322168560950512 * (x[43] + x[53]) +
+    0.07393868525436442 * (x[45] + x[51]) +
+    0.15812784989985906 * (x[46] + x[50]) +
+    0.2247190477116732 * (x[47] + x[49]) +
+    0.2500057446931845 * x[48];
+  memcpy(&x[92], x, 4 * sizeof(double));
+  return y;
+}
+
+static double decimate_4x_31(double* x) {
+  double y = -0.0005412449899570594 * (x[33] + x[63]) +
+    -0.0015283942104147741 * (x[34] + x[62]) +
+    -0.001896318536488949 * (x[35] + x[61]) +
+    0.004692447229083324 * (x[37] + x[59]) +
+    0.009733419746928897 * (x[38] + x[58]) +
+    0.009783051739172802 * (x[39] + x[57]) +
+    -0.018575788341167916 * (x[41] + x[55]) +
+    -0.035634217664346504 * (x[42] + x[54]) +
+    -0.03424459733518229 * (x[43] + x[53]) +
+    0.0680870580300853 * (x[45] + x[51]) +
+    0.15246043735288986 * (x[46] + x[50]) +
+    0.22267104242548255 * (x[47] + x[49]) +
+    0.2499862091078293 * x[48];
+  memcpy(&x[92], x, 4 * sizeof(double));
+  return y;
+}
+
+static double decimate_4x_15(double* x) {
+  double y = -0.010671645464725332 * (x[41] + x[55]) +
+    -0.024796585769411583 * (x[42] + x[54]) +
+    -0.027239785374262533 * (x[43] + x[53]) +
+    0.06369235127646389 * (x[45] + x[51]) +
+    0.14911830080882668 * (x[46] + x[50]) +
+    0.22342886931687297 * (x[47] + x[49]) +
+    0.2529369904124718 * x[48];
+  memcpy(&x[92], x, 4 * sizeof(double));
+  return y;
+}
+
+static double decimate_2x_47(double* x) {
+  double y = -9.059433803985391e-05 * (x[1] + x[47]) +
+    0.000359164283763972 * (x[3] + x[45]) +
+    -0.0009655444852048825 * (x[5] + x[43]) +
+    0.0021358848133315373 * (x[7] + x[41]) +
+    -0.004174741248947001 * (x[9] + x[39]) +
+    0.00748695012627595 * (x[11] + x[37]) +
+    -0.01263709284061132 * (x[13] + x[35]) +
+    0.020518774472112887 * (x[15] + x[33]) +
+    -0.03286295861943506 * (x[17] + x[31]) +
+    0.054031543261949845 * (x[19] + x[29]) +
+    -0.10005944301888371 * (x[21] + x[27]) +
+    0.3162538082243835 * (x[23] + x[25]) +
+    0.5000084987386084 * x[24];
+  memcpy(&x[46], x, 2 * sizeof(double));
+  return y;
+}
+
+static double decimate_2x_15(double* x) {
+  double y = -0.0030564907213355688 * (x[17] + x[31]) +
+    0.019464943625557844 * (x[19] + x[29]) +
+    -0.07126149452212965 * (x[21] + x[27]) +
+    0.30489117857454434 * (x[23] + x[25]) +
+    0.49992372608672603 * x[24];
+  memcpy(&x[46], x, 2 * sizeof(double));
+  return y;
+}
+
+static double decimate_2x_7(double* x) {
+  double y = -0.04943690932976038 * (x[21] + x[27]) +
+    0.29729689341295285 * (x[23] + x[25]) +
+    0.504280031833615 * x[24];
+  memcpy(&x[46], x, 2 * sizeof(double));
+  return y;
+}
+
+/* Minimum-phase counterparts of the decimators above for the low-latency mode: the same magnitude response, with
+   most of the delay removed (generated by tools/ayumi-fir/design_decimators.py) */
+static const double min_phase_192[192] = {
+  1.4133040735894484e-05, 6.520278094450003e-05, 0.0001954364969482734, 0.0004719525143897611,
+  0.000992024360494878, 0.0018859078277087377, 0.003315689406174879, 0.00546870904873398,
+  0.008544491261550536, 0.012734854129977527, 0.018197871548326063, 0.025027485484610316,
+  0.03322172983597185, 0.042653555096618306, 0.053048867832638485, 0.0639764638386935,
+  0.0748539893725376, 0.08497274862731538, 0.09354215510542103, 0.09975218991269719,
+  0.10284959289759078, 0.10222090583761577, 0.0974734773180133, 0.08850449979233604,
+  0.07554816097997673, 0.05919239913915174, 0.040359568282824616, 0.02024904292917756,
+  0.00024433605462338817, -0.018207905223525018, -0.033735607989744336, -0.04518105830676834,
+  -0.05172661226138199, -0.05299079423438216, -0.04908154786127619, -0.040598068462833425,
+  -0.028578262234398737, -0.014395633299778702, 0.0003842713457686934, 0.014172173648487357,
+  0.02552876347750011, 0.03332303620551836, 0.03685582639468278, 0.03593296349392114,
+  0.030878507025846144, 0.022485965209981966, 0.011913272812510953, 0.0005345821614537507,
+  -0.010232397578913349, -0.0191015367979691, -0.025073580469414755, -0.027551906707171205,
+  -0.02640435687414923, -0.021963958711479825, -0.01496954407340097, -0.00645528530647627,
+  0.002395097113917635, 0.010409210467861854, 0.01658001970406378, 0.020192509285920594,
+  0.020906632715415555, 0.018786610551049465, 0.014274294940304228, 0.008112130233888895,
+  0.0012281014625225293, -0.005400016638377864, -0.010881448610386327, -0.014531107353339151,
+  -0.015954267520874695, -0.015086712337077497, -0.012186578651940545, -0.007781164941748337,
+  -0.0025782966143861347, 0.0026434665072677674, 0.007149053699557185, 0.01034890709602784,
+  0.011874705129640142, 0.011619164993838176, 0.009736008836784797, 0.0066021964483782055,
+  0.002749955075283974, -0.0012197953707629161, -0.0047288889300451725, -0.007304509944341084,
+  -0.00864127840679721, -0.008634868962050238, -0.00738389163519516, -0.005161698167903285,
+  -0.0023641745719989843, 0.0005571681311464036, 0.003165856252746797, 0.0051040281137182935,
+  0.006139852699819286, 0.006192734820077329, 0.005334041873721881, 0.0037649293996785418,
+  0.0017762572688946048, -0.000302036442497192, -0.002153631696866827, -0.003522396717139638,
+  -0.00424618980619833, -0.004273670837942366, -0.003662865158885657, -0.002563117101109212,
+  -0.0011845419625956882, 0.00023930094906216462, 0.0014891795327503868, 0.0023925144118869114,
+  0.002845686381115687, 0.002823703092337205, 0.0023767960537452682, 0.0016156226102838755,
+  0.000688399768752451, -0.00024571412968697775, -0.0010424549111202363, -0.00159350278544864,
+  -0.0018398570386992255, -0.0017761315642023587, -0.0014459501021079262, -0.0009300273190011658,
+  -0.00032955481448703356, 0.00025198425803622993, 0.0007254939665600878, 0.0010289010545226317,
+  0.0011341230079925054, 0.0010478230662896173, 0.0008064777862279446, 0.0004671572404502447,
+  9.59715190574804e-05, -0.00024367291419734433, -0.0005010603487942214, -0.0006449395943790335,
+  -0.0006663269193122046, -0.0005773191149230317, -0.0004065657237662123, -0.00019253570368533204,
+  2.4055618383715517e-05, 0.00020728174053017805, 0.0003313892792181543, 0.00038381026496011087,
+  0.0003655803841773468, 0.00028941316464843055, 0.000176041488279792, 4.9657019805976726e-05,
+  -6.665416288218154e-05, -0.00015470137998220665, -0.0002036414905462437, -0.00021083580764299722,
+  -0.00018117728388122373, -0.0001252039258193107, -5.6479931363191254e-05, 1.1197390595965866e-05,
+  6.624927415345285e-05, 0.00010103629240881954, 0.00011263289506621612, 0.00010265416568085712,
+  7.629122557438201e-05, 4.0862240457889897e-05, 4.158761858503964e-06, -2.701458447216248e-05,
+  -4.795478277764273e-05, -5.656880404085962e-05, -5.3371230683528345e-05, -4.097215995878347e-05,
+  -2.3252871123143862e-05, -4.457325892651687e-06, 1.168631549764479e-05, 2.2592556189008742e-05,
+  2.711363099407594e-05, 2.5537299431106503e-05, 1.9289839810591123e-05, 1.0460415457448176e-05,
+  1.2919503282865632e-06, -6.294316269739801e-06, -1.1044981815047057e-05, -1.2510589918037388e-05,
+  -1.0999815287372492e-05, -7.4007727779999234e-06, -2.9025779532206634e-06, 1.312089017718366e-06,
+  4.31884979861837e-06, 5.6172981277202e-06, 5.1900444028214765e-06, 3.4441433735170648e-06,
+  1.0675551743405953e-06, -1.1489221512779207e-06, -2.50698368061414e-06, -2.5952006499306096e-06,
+  -1.44736776859748e-06, 3.422781471518007e-07, 1.5090486252246107e-06, 4.5643013705724557e-10
+};
+
+static const double min_phase_63[63] = {
+  0.00018406625792198266, 0.0007615688401297299, 0.002058152957215063, 0.004486119316748908,
+  0.008501771970156552, 0.014534789975683476, 0.022896859358317853, 0.033681921024173625,
+  0.04667669591118271, 0.0613022452306028, 0.07660498920743151, 0.09130986338401906,
+  0.10393811751979959, 0.11298031277102974, 0.11710290675069256, 0.11535734389383093,
+  0.10735671710219245, 0.09338609849094519, 0.07442215927378885, 0.05205111391258707,
+  0.028290671288976655, 0.005340273017505401, -0.014704273389628677, -0.030126540458558337,
+  -0.039811552836819204, -0.043378652590988186, -0.04120361610390619, -0.03432893890720571,
+  -0.024278909177654198, -0.012812891951993614, -0.0016590503540716986, 0.007727204836107034,
+  0.014342514558881744, 0.017728048989724958, 0.017967280122709855, 0.015598212875040525,
+  0.011463484439157044, 0.006530708255907919, 0.0017170658002918654, -0.0022517579609980846,
+  -0.004928684739229725, -0.006169871273073312, -0.006102397425101276, -0.005049354969103227,
+  -0.003433017869694006, -0.0016783389314674664, -0.00013427134780539144, 0.0009743174295316416,
+  0.0015610442374967633, 0.0016623237163796206, 0.0014004114730057776, 0.0009375221917912588,
+  0.00043210467378959004, 6.283595112677788e-06, -0.00027093715809824387, -0.00038463087106165375,
+  -0.0003624514094360577, -0.00025633476443235237, -0.0001230479805132626, -8.726639237292777e-06,
+  5.961338960340137e-05, 7.573023209804315e-05, 4.962083851604784e-05
+};
+
+static const double min_phase_31[31] = {
+  0.002860644476021726, 0.008603367516521571, 0.01783664626673604, 0.030726236457790806,
+  0.04684677886652513, 0.06513007137621914, 0.08392973112901021, 0.10120858210494195,
+  0.11482131456994575, 0.1228579230525908, 0.12397255689209494, 0.11763671911263918,
+  0.10426003375561896, 0.08516379227851045, 0.06239654902536864, 0.03841981864951427,
+  0.01573236890977789, -0.0035028797563600536, -0.01776067114947538, -0.026330323443122635,
+  -0.029349839832014734, -0.02769006983226576, -0.02272015146970417, -0.01602143260865773,
+  -0.009098921566177188, -0.0031469213589296473, 0.0010992902016888832, 0.003395431523170876,
+  0.003922054682728419, 0.003146101078001688, 0.0016551990912901603
+};
+
+static const double min_phase_4x_95[95] = {
+  0.00019112613556723527, 0.0012436356074867474, 0.004666981813485173, 0.012953602684895173,
+  0.02916550848058462, 0.05574459033934905, 0.09271342326517203, 0.13595251773074535,
+  0.17660117092209582, 0.2025100236303543, 0.20192841101961784, 0.16844357257603473,
+  0.10515219309234987, 0.025793904393839485, -0.04850251107759149, -0.09631940467240684,
+  -0.10431462506322203, -0.07316543880302126, -0.018022029146453063, 0.03731080825374476,
+  0.07026434709454606, 0.06909232058971466, 0.037639397085339525, -0.007069415260486383,
+  -0.04331005875921418, -0.05507151821807288, -0.039280687943742024, -0.006370531590056427,
+  0.025835250040603865, 0.04153128143720115, 0.03467354470728464, 0.011184239246323181,
+  -0.015158313042475124, -0.030553186575057335, -0.02833724952362944, -0.011742597694904518,
+  0.008838082511548532, 0.02212053729987542, 0.02202715949185951, 0.010335542868978781,
+  -0.005205914289957549, -0.01578304749889373, -0.016420218796598916, -0.008187646215754954,
+  0.003185236320915993, 0.011080548906446561, 0.011748915847453259, 0.0059600122236235,
+  -0.0020918284991126848, -0.007631473755550067, -0.008046116452898596, -0.0039944901554156455,
+  0.0014985318322234622, 0.00513517954812375, 0.005244980441779109, 0.0024384035151387,
+  -0.0011514124942330589, -0.0033605977311422703, -0.003231371233972875, -0.0013246682965378212,
+  0.0009025515685804509, 0.00211654176715502, 0.001850887705475396, 0.000593385245858553,
+  -0.0007034979875616494, -0.0012812068387593808, -0.0009766556600780448, -0.0001823988596718665,
+  0.0005149548478104849, 0.0007295809359190684, 0.0004586400749230728, -9.923320215369796e-06,
+  -0.0003437727993022719, -0.00037912010146487057, -0.00017711756225819797, 7.28268672822617e-05,
+  0.00020432406605307518, 0.0001711849388987713, 4.3001596334258867e-05, -7.132063801252522e-05,
+  -0.00010410815426742654, -6.028778785718689e-05, 7.288586746311981e-06, 4.6858411272953306e-05,
+  4.167776062078463e-05, 1.0467165438438278e-05, -1.6434327378162406e-05, -2.1708281013803552e-05,
+  -9.202491344395577e-06, 5.420204819498582e-06, 9.959227099573022e-06, 4.04750261178913e-06,
+  -3.508347711928634e-06, -4.043975992837763e-06, 2.080496089078726e-06
+};
+
+static const double min_phase_4x_31[31] = {
+  0.002009503715530595, 0.010887121658025217, 0.033514890127039114, 0.07479149530170191,
+  0.1319372222570048, 0.19101785622045062, 0.22974330131784734, 0.22721173785854995,
+  0.17609409943902402, 0.08961066517615073, -0.0023911324158827794, -0.0673828026296253,
+  -0.08640454562713136, -0.06283289375777891, -0.018457167194936265, 0.02016756100062085,
+  0.03614605118280678, 0.02882759566027288, 0.009927846026200646, -0.006449908805630208,
+  -0.012499745463847014, -0.009120266076165865, -0.0022984256772615266, 0.0024232350056808604,
+  0.0032076524418295244, 0.0015426282969865789, -0.000197729382669736, -0.0007762620477751838,
+  -0.0004289083516835027, 3.354047904554066e-05, 0.0001457842656196696
+};
+
+static const double min_phase_4x_15[15] = {
+  0.01851403595023348, 0.06446540256489827, 0.13431609517607512, 0.20581786140058203,
+  0.24660834393474657, 0.23284610358296015, 0.16545487651395277, 0.0716398726804653,
+  -0.010429980805768508, -0.05340657877469465, -0.054064548092315076, -0.030110582036058358,
+  -0.004969636708350628, 0.007167491281155107, 0.006151243332118253
+};
+
+static const double min_phase_2x_47[47] = {
+  0.008686716221456042, 0.06027841167368287, 0.19354640903693202, 0.3631783168503968,
+  0.4023130361454285, 0.19263227288399393, -0.11273902338418991, -0.20246022834014277,
+  -0.017723927405441743, 0.14343118518578327, 0.06045274965472605, -0.09349742403698491,
+  -0.06780461527645792, 0.059480343604750296, 0.06181889775764227, -0.03759632032232208,
+  -0.05143848030843426, 0.023826327390619163, 0.04038089722456838, -0.015273024119700374,
+  -0.03022232064387187, 0.010002993614284741, 0.021600985579440724, -0.006752338543910452,
+  -0.01470302734442893, 0.004707723790574844, 0.009473649512530002, -0.0033621362569685735,
+  -0.005726166388723697, 0.0024085775248866024, 0.003187693136181422, -0.001709249427625099,
+  -0.001611252513030183, 0.0011527233865926544, 0.0007053547535599941, -0.0007164935374943006,
+  -0.00023570494544490785, 0.00039797730200069365, 2.9156669903559003e-05, -0.00018816901263481157,
+  3.522178937971637e-05, 6.76431881856607e-05, -3.5647026859513826e-05, -1.1055335686755267e-05,
+  1.6951768225574017e-05, -6.556247030434765e-06, 9.447716576561022e-07
+};
+
+static const double min_phase_2x_15[15] = {
+  0.054346224273725464, 0.2495997287601941, 0.4588705357825194, 0.3679587634260196,
+  0.012905128672434577, -0.16735848801790235, -0.04258848846202428, 0.06742920673300339,
+  0.021553035239393756, -0.02248668303799231, -0.0051671557474891, 0.005570697708243642,
+  -1.490686630189211e-05, -0.0007894987242360487, 0.00017190026041211768
+};
+
+static const double min_phase_2x_7[7] = {
+  0.15525881451553025, 0.4380988372236514, 0.4420947877464194, 0.10203946046917131,
+  -0.10881507958496539, -0.04441832972836475, 0.01574150935855773
+};
+
+/* Not symmetric, so twice the multiplications of a linear-phase filter; four partial sums keep the FPU busy. */
+static double decimate_min_phase(double* x, const double* h, int size, int factor) {
+  int i;
+  double y0 = 0;
+  double y1 = 0;
+  double y2 = 0;
+  double y3 = 0;
+  for (i = 0; i + 3 < size; i += 4) {
+    y0 += h[i] * x[i];
+    y1 += h[i + 1] * x[i + 1];
+    y2 += h[i + 2] * x[i + 2];
+    y3 += h[i + 3] * x[i + 3];
+  }
+  for (; i < size; i += 1) {
+    y0 += h[i] * x[i];
+  }
+  memcpy(&x[FIR_FRAMES * factor - factor], x, factor * sizeof(double));
+  return (y0 + y1) + (y2 + y3);
+}
+
+static double decimate_min_phase_192(double* x) {
+  return decimate_min_phase(x, min_phase_192, 192, 8);
+}
+
+static double decimate_min_phase_63(double* x) {
+  return decimate_min_phase(x, min_phase_63, 63, 8);
+}
+
+static double decimate_min_phase_31(double* x) {
+  return decimate_min_phase(x, min_phase_31, 31, 8);
+}
+
+static double decimate_min_phase_4x_95(double* x) {
+  return decimate_min_phase(x, min_phase_4x_95, 95, 4);
+}
+
+static double decimate_min_phase_4x_31(double* x) {
+  return decimate_min_phase(x, min_phase_4x_31, 31, 4);
+}
+
+static double decimate_min_phase_4x_15(double* x) {
+  return decimate_min_phase(x, min_phase_4x_15, 15, 4);
+}
+
+static double decimate_min_phase_2x_47(double* x) {
+  return decimate_min_phase(x, min_phase_2x_47, 47, 2);
+}
+
+static double decimate_min_phase_2x_15(double* x) {
+  return decimate_min_phase(x, min_phase_2x_15, 15, 2);
+}
+
+static double decimate_min_phase_2x_7(double* x) {
+  return decimate_min_phase(x, min_phase_2x_7, 7, 2);
+}
+
+typedef double (*decimator)(double* x);
+
+/* by [8x, 4x, 2x oversampling][low_latency][quality] */
+static const decimator Decimators[3][2][AYUMI_QUALITY_TIERS] = {
+  {
+    {decimate, decimate_63, decimate_31},
+    {decimate_min_phase_192, decimate_min_phase_63, decimate_min_phase_31}
+  },
+  {
+    {decimate_4x_95, decimate_4x_31, decimate_4x_15},
+    {decimate_min_phase_4x_95, decimate_min_phase_4x_31, decimate_min_phase_4x_15}
+  },
+  {
+    {decimate_2x_47, decimate_2x_15, decimate_2x_7},
+    {decimate_min_phase_2x_47, decimate_min_phase_2x_15, decimate_min_phase_2x_7}
+  }
+};
+
+/* and their coefficients, by [8x, 4x, 2x oversampling][quality] */
+static const double* const MinPhase[3][AYUMI_QUALITY_TIERS] = {
+  {min_phase_192, min_phase_63, min_phase_31},
+  {min_phase_4x_95, min_phase_4x_31, min_phase_4x_15},
+  {min_phase_2x_47, min_phase_2x_15, min_phase_2x_7}
+};
+static const int MinPhaseSize[3][AYUMI_QUALITY_TIERS] = {{192, 63, 31}, {95, 31, 15}, {47, 15, 7}};
+
+static int factor_index(const struct ayumi* ay) {
+  return ay->decimate_factor == 8 ? 0 : ay->decimate_factor == 4 ? 1 : 2;
+}
+
+static decimator get_decimator(const struct ayumi* ay) {
+  return Decimators[factor_index(ay)][ay->low_latency][ay->quality];
+}
+
 void ayumi_process(struct ayumi* ay) {
   int i;
   double y1;
@@ -292,10 +771,12 @@ void ayumi_process(struct ayumi* ay) {
   double* y_left = ay->interpolator_left.y;
   double* c_right = ay->interpolator_right.c;
   double* y_right = ay->interpolator_right.y;
-  double* fir_left = &ay->fir_left[FIR_SIZE - ay->fir_index * DECIMATE_FACTOR];
-  double* fir_right = &ay->fir_right[FIR_SIZE - ay->fir_index * DECIMATE_FACTOR];
-  ay->fir_index = (ay->fir_index + 1) % (FIR_SIZE / DECIMATE_FACTOR - 1);
-  for (i = DECIMATE_FACTOR - 1; i >= 0; i -= 1) {
+  int factor = ay->decimate_factor;
+  double* fir_left = &ay->fir_left[(FIR_FRAMES - ay->fir_index) * factor];
+  double* fir_right = &ay->fir_right[(FIR_FRAMES - ay->fir_index) * factor];
+  decimator filter = get_decimator(ay);
+  ay->fir_index = (ay->fir_index + 1) % (FIR_FRAMES - 1);
+  for (i = factor - 1; i >= 0; i -= 1) {
     ay->x += ay->step;
     if (ay->x >= 1) {
       ay->x -= 1;
@@ -320,8 +801,89 @@ void ayumi_process(struct ayumi* ay) {
     fir_left[i] = (c_left[2] * ay->x + c_left[1]) * ay->x + c_left[0];
     fir_right[i] = (c_right[2] * ay->x + c_right[1]) * ay->x + c_right[0];
   }
-  ay->left = decimate(fir_left);
-  ay->right = decimate(fir_right);
+  ay->left = filter(fir_left);
+  ay->right = filter(fir_right);
+}
+
+void ayumi_process_mono(struct ayumi* ay) {
+  int i;
+  double y1;
+  double* c = ay->interpolator_left.c;
+  double* y = ay->interpolator_left.y;
+  int factor = ay->decimate_factor;
+  double* fir = &ay->fir_left[(FIR_FRAMES - ay->fir_index) * factor];
+  decimator filter = get_decimator(ay);
+  ay->fir_index = (ay->fir_index + 1) % (FIR_FRAMES - 1);
+  for (i = factor - 1; i >= 0; i -= 1) {
+    ay->x += ay->step;
+    if (ay->x >= 1) {
+      ay->x -= 1;
+      y[0] = y[1];
+      y[1] = y[2];
+      y[2] = y[3];
+      update_mixer_mono(ay);
+      y[3] = ay->left;
+      y1 = y[2] - y[0];
+      c[0] = 0.5 * y[1] + 0.25 * (y[0] + y[2]);
+      c[1] = 0.5 * y1;
+      c[2] = 0.25 * (y[3] - y[1] - y1);
+    }
+    fir[i] = (c[2] * ay->x + c[1]) * ay->x + c[0];
+  }
+  ay->left = filter(fir);
+  ay->right = ay->left;
+}
+
+static void interpolate(struct interpolator* in, double y3) {
+  double y1;
+  double* c = in->c;
+  double* y = in->y;
+  y[0] = y[1];
+  y[1] = y[2];
+  y[2] = y[3];
+  y[3] = y3;
+  y1 = y[2] - y[0];
+  c[0] = 0.5 * y[1] + 0.25 * (y[0] + y[2]);
+  c[1] = 0.5 * y1;
+  c[2] = 0.25 * (y[3] - y[1] - y1);
+}
+
+void ayumi_process_stems(struct ayumi* ay, struct ayumi_stem* stems) {
+  int i;
+  int j;
+  double left[TONE_CHANNELS];
+  double right[TONE_CHANNELS];
+  double* c_left;
+  double* c_right;
+  int factor = ay->decimate_factor;
+  int offset = (FIR_FRAMES - ay->fir_index) * factor;
+  decimator filter = get_decimator(ay);
+  ay->fir_index = (ay->fir_index + 1) % (FIR_FRAMES - 1);
+  for (i = factor - 1; i >= 0; i -= 1) {
+    ay->x += ay->step;
+    if (ay->x >= 1) {
+      ay->x -= 1;
+      update_mixer_stems(ay, left, right);
+      for (j = 0; j < TONE_CHANNELS; j += 1) {
+        interpolate(&stems[j].interpolator_left, left[j]);
+        interpolate(&stems[j].interpolator_right, right[j]);
+      }
+    }
+    for (j = 0; j < TONE_CHANNELS; j += 1) {
+      c_left = stems[j].interpolator_left.c;
+      c_right = stems[j].interpolator_right.c;
+      stems[j].fir_left[offset + i] = (c_left[2] * ay->x + c_left[1]) * ay->x + c_left[0];
+      stems[j].fir_right[offset + i] = (c_right[2] * ay->x + c_right[1]) * ay->x + c_right[0];
+    }
+  }
+  ay->left = 0;
+  ay->right = 0;
+  for (j = 0; j < TONE_CHANNELS; j += 1) {
+    stems[j].left = filter(&stems[j].fir_left[offset]);
+    stems[j].right = filter(&stems[j].fir_right[offset]);
+    ay->left += stems[j].left;
+    ay->right += stems[j].right;
+  }
 }
 
 static double dc_filter(struct dc_filter* dc, int index, double x) {
@@ -330,8 +892,572 @@ static double dc_filter(struct dc_filter* dc, int index, double x) {
   return x - dc->sum / DC_FILTER_SIZE;
 }
 
+/* The running sum is recomputed once per DC_FILTER_SIZE frames, so that rounding errors do not accumulate
+   and the filter state depends only on the last DC_FILTER_SIZE inputs. */
+static void dc_filter_resync(struct dc_filter* dc) {
+  int i;
+  double sum = 0;
+  for (i = 0; i < DC_FILTER_SIZE; i += 1) {
+    sum += dc->delay[i];
+  }
+  dc->sum = sum;
+}
+
+/* Exponential moving average in place of the moving average, with a time constant of DC_FILTER_SIZE / 2 frames
+   (about the same low cut). `sum` stays DC_FILTER_SIZE times the tracked level, so that the filters can be switched
+   either way. */
+static double dc_filter_one_pole(struct dc_filter* dc, double x) {
+  double y = x - dc->sum / DC_FILTER_SIZE;
+  dc->sum += 2 * y;
+  return y;
+}
+
+/* Refills the moving-average history with the level tracked by the one-pole filter. */
+static void dc_filter_fill(struct dc_filter* dc) {
+  int i;
+  double level = dc->sum / DC_FILTER_SIZE;
+  for (i = 0; i < DC_FILTER_SIZE; i += 1) {
+    dc->delay[i] = level;
+  }
+  dc->sum = level * DC_FILTER_SIZE;
+}
+
 void ayumi_remove_dc(struct ayumi* ay) {
+  if (ay->quality >= AYUMI_QUALITY_LOW) {
+    ay->left = dc_filter_one_pole(&ay->dc_left, ay->left);
+    ay->right = dc_filter_one_pole(&ay->dc_right, ay->right);
+    return;
+  }
   ay->left = dc_filter(&ay->dc_left, ay->dc_index, ay->left);
   ay->right = dc_filter(&ay->dc_right, ay->dc_index, ay->right);
   ay->dc_index = (ay->dc_index + 1) & (DC_FILTER_SIZE - 1);
+  if (ay->dc_index == 0) {
+    dc_filter_resync(&ay->dc_left);
+    dc_filter_resync(&ay->dc_right);
+  }
+}
+
+void ayumi_remove_dc_stems(struct ayumi* ay, struct ayumi_stem* stems) {
+  int j;
+  ay->left = 0;
+  ay->right = 0;
+  if (ay->quality >= AYUMI_QUALITY_LOW) {
+    for (j = 0; j < TONE_CHANNELS; j += 1) {
+      stems[j].left = dc_filter_one_pole(&stems[j].dc_left, stems[j].left);
+      stems[j].right = dc_filter_one_pole(&stems[j].dc_right, stems[j].right);
+      ay->left += stems[j].left;
+      ay->right += stems[j].right;
+    }
+    return;
+  }
+  for (j = 0; j < TONE_CHANNELS; j += 1) {
+    stems[j].left = dc_filter(&stems[j].dc_left, ay->dc_index, stems[j].left);
+    stems[j].right = dc_filter(&stems[j].dc_right, ay->dc_index, stems[j].right);
+    ay->left += stems[j].left;
+    ay->right += stems[j].right;
+  }
+  ay->dc_index = (ay->dc_index + 1) & (DC_FILTER_SIZE - 1);
+  for (j = 0; j < TONE_CHANNELS && ay->dc_index == 0; j += 1) {
+    dc_filter_resync(&stems[j].dc_left);
+    dc_filter_resync(&stems[j].dc_right);
+  }
+}
+
+void ayumi_remove_dc_mono(struct ayumi* ay) {
+  if (ay->quality >= AYUMI_QUALITY_LOW) {
+    ay->left = dc_filter_one_pole(&ay->dc_left, ay->left);
+    ay->right = ay->left;
+    return;
+  }
+  ay->left = dc_filter(&ay->dc_left, ay->dc_index, ay->left);
+  ay->right = ay->left;
+  ay->dc_index = (ay->dc_index + 1) & (DC_FILTER_SIZE - 1);
+  if (ay->dc_index == 0) {
+    dc_filter_resync(&ay->dc_left);
+  }
+}
+
+void ayumi_set_quality(struct ayumi* ay, struct ayumi_stem* stems, int quality) {
+  int j;
+  if (quality < AYUMI_QUALITY_FULL) {
+    quality = AYUMI_QUALITY_FULL;
+  } else if (quality >= AYUMI_QUALITY_TIERS) {
+    quality = AYUMI_QUALITY_TIERS - 1;
+  }
+  if (ay->quality >= AYUMI_QUALITY_LOW && quality < AYUMI_QUALITY_LOW) {
+    dc_filter_fill(&ay->dc_left);
+    dc_filter_fill(&ay->dc_right);
+    for (j = 0; stems != NULL && j < TONE_CHANNELS; j += 1) {
+      dc_filter_fill(&stems[j].dc_left);
+      dc_filter_fill(&stems[j].dc_right);
+    }
+  }
+  ay->quality = quality;
+}
+
+void ayumi_save(const struct ayumi* ay, struct ayumi_snapshot* snapshot) {
+  snapshot->ay = *ay;
+  snapshot->ay.dac_table = 0;
+  snapshot->is_ym = ay->dac_table == YM_dac_table;
+}
+
+void ayumi_restore(struct ayumi* ay, const struct ayumi_snapshot* snapshot) {
+  *ay = snapshot->ay;
+  ay->dac_table = snapshot->is_ym ? YM_dac_table : AY_dac_table;
+}
+
+/* Advances a counter that wraps (and fires) when counter + 1 >= period by `ticks`; returns the number of wraps.
+   The counter may be above the period if the period was just lowered, then the next tick wraps it. */
+static long long advance_counter(int* counter, int period, long long ticks) {
+  long long first = *counter >= period ? 1 : period - *counter;
+  if (ticks < first) {
+    *counter += (int) ticks;
+    return 0;
+  }
+  ticks -= first;
+  *counter = (int) (ticks % period);
+  return 1 + ticks / period;
+}
+
+/* The noise LFSR is linear over GF(2): a shift is the matrix whose column j is the shift of bit j alone.
+   Matrices are stored as their 17 columns. */
+static int noise_apply(const int* m, int noise) {
+  int i;
+  int y = 0;
+  for (i = 0; i < 17; i += 1) {
+    if (noise & (1 << i)) {
+      y ^= m[i];
+    }
+  }
+  return y;
+}
+
+static int noise_shift(int noise, long long shifts) {
+  int i;
+  int m[17];
+  int t[17];
+  if (shifts < 64) {
+    /* cheaper than building the matrix, which matters when fast-forwarding frame by frame. */
+    for (; shifts > 0; shifts -= 1) {
+      noise = (noise >> 1) | (((noise ^ (noise >> 3)) & 1) << 16);
+    }
+    return noise;
+  }
+  for (i = 0; i < 17; i += 1) {
+    m[i] = ((1 << i) >> 1) | ((((1 << i) ^ ((1 << i) >> 3)) & 1) << 16);
+  }
+  for (; shifts > 0; shifts >>= 1) {
+    if (shifts & 1) {
+      noise = noise_apply(m, noise);
+    }
+    for (i = 0; i < 17; i += 1) {
+      t[i] = noise_apply(m, m[i]);
+    }
+    memcpy(m, t, sizeof(m));
+  }
+  return noise;
+}
+
+static void envelope_steps(struct ayumi* ay, long long steps) {
+  int crossed = 0;
+  int remaining;
+  void (*f)(struct ayumi*);
+  while (steps > 0) {
+    f = Envelopes[ay->envelope_shape][ay->envelope_segment];
+    if (f == hold_top || f == hold_bottom) {
+      return;
+    }
+    remaining = f == slide_up ? 32 - ay->envelope : ay->envelope + 1;
+    if (steps < remaining) {
+      ay->envelope += f == slide_up ? (int) steps : (int) -steps;
+      return;
+    }
+    steps -= remaining;
+    ay->envelope_segment ^= 1;
+    reset_segment(ay);
+    if (!crossed) {
+      /* from the start of a segment, the repeating shapes (two sliding segments) come back after 64 steps. */
+      steps %= 64;
+      crossed = 1;
+    }
+  }
+}
+
+void ayumi_advance(struct ayumi* ay, long long ticks) {
+  int i;
+  struct tone_channel* ch;
+  ay->noise = noise_shift(ay->noise, advance_counter(&ay->noise_counter, ay->noise_period ? ay->noise_period << 1 : 1, ticks));
+  envelope_steps(ay, advance_counter(&ay->envelope_counter, ay->envelope_period, ticks));
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    ch = &ay->channels[i];
+    ch->tone ^= (int) (advance_counter(&ch->tone_counter, ch->tone_period, ticks) & 1);
+  }
+}
+
+/* bits of the phase accumulator x in [0, 1) at the resolution it has in [1, 2), before the wrap */
+#define PHASE_BITS 52
+#define PHASE_ONE (1ULL << PHASE_BITS)
+
+void ayumi_fast_forward(struct ayumi* ay, int frames) {
+  int i;
+  long long ticks = 0;
+  double x = ldexp(ay->x, PHASE_BITS);
+  double step = ldexp(ay->step, PHASE_BITS);
+  unsigned long long n = frames > 0 ? (unsigned long long) frames * ay->decimate_factor : 0;
+  unsigned long long low = (1ULL << 26) - 1;
+  unsigned long long hi;
+  unsigned long long mid;
+  if (x == floor(x) && step == floor(step) && step <= PHASE_ONE) {
+    /* x and step are integers in units of 2^-PHASE_BITS, and every x += step of ayumi_process() is exact, so
+       x + n * step (split in 26-bit halves of step, to stay in 64 bits) gives the same ticks and x. */
+    hi = n * ((unsigned long long) step >> 26);
+    mid = (((hi & low) << 26) + (unsigned long long) x) + n * ((unsigned long long) step & low);
+    ticks = (long long) ((hi >> 26) + (mid >> PHASE_BITS));
+    ay->x = ldexp((double) (mid & (PHASE_ONE - 1)), -PHASE_BITS);
+  } else {
+    /* the usual case, as the step is not rounded to the grid (that would change the output of ayumi_process()),
+       and x += step rounds: stepped as in ayumi_process(), so that it stays bit-identical. */
+    for (i = frames * ay->decimate_factor; i > 0; i -= 1) {
+      ay->x += ay->step;
+      if (ay->x >= 1) {
+        ay->x -= 1;
+        ticks += 1;
+      }
+    }
+  }
+  ayumi_advance(ay, ticks);
+  ay->fir_index = (ay->fir_index + frames) % (FIR_FRAMES - 1);
+  ay->dc_index = (ay->dc_index + frames) & (DC_FILTER_SIZE - 1);
+}
+
+/* delay of the interpolator, in chip ticks */
+#define INTERPOLATOR_DELAY 1.5
+
+void ayumi_set_low_latency(struct ayumi* ay, int enabled) {
+  ay->low_latency = enabled != 0;
+}
+
+double ayumi_latency(const struct ayumi* ay) {
+  int i;
+  const double* h = MinPhase[factor_index(ay)][ay->quality];
+  double delay = FIR_FRAMES / 2 * ay->decimate_factor;
+  if (ay->low_latency) {
+    /* group delay at DC; the coefficients sum up to 1 */
+    delay = 0;
+    for (i = 0; i < MinPhaseSize[factor_index(ay)][ay->quality]; i += 1) {
+      delay += i * h[i];
+    }
+  }
+  return (delay + INTERPOLATOR_DELAY / ay->step) / ay->decimate_factor;
+}
+
+int ayumi_preroll_frames(const struct ayumi* ay) {
+  /* 4 chip ticks for the interpolator, then the whole FIR window */
+  return (int) ceil(4 / (ay->step * ay->decimate_factor)) + FIR_FRAMES + 1;
+}
+
+#define AYUMI_PI 3.14159265358979323846
+/* harmonics above this (in cycles per output frame) are left out of the cached tones */
+#define TONE_CACHE_CUTOFF 0.5
+
+/* Gain of the full quality decimator at `f` cycles per output frame (it is linear phase, so the cosine response
+   is real). */
+static double decimator_gain(int factor_index, double f) {
+  int i;
+  int factor = DECIMATE_FACTOR >> factor_index;
+  double x[FIR_SIZE];
+  for (i = 0; i < FIR_FRAMES * factor; i += 1) {
+    x[i] = cos(2 * AYUMI_PI * f * (i - FIR_FRAMES * factor / 2) / factor);
+  }
+  return Decimators[factor_index][0][AYUMI_QUALITY_FULL](x);
+}
+
+void ayumi_tone_cache_init(struct ayumi_tone_cache* cache) {
+  int i;
+  int j;
+  memset(cache, 0, sizeof(struct ayumi_tone_cache));
+  for (i = 0; i < TONE_CACHE_SIZE; i += 1) {
+    cache->sine[i] = sin(2 * AYUMI_PI * i / TONE_CACHE_SIZE);
+  }
+  for (i = 0; i < 3; i += 1) {
+    for (j = 0; j <= TONE_CACHE_GAIN_POINTS; j += 1) {
+      cache->decimator_gain[i][j] = decimator_gain(i, TONE_CACHE_CUTOFF * j / TONE_CACHE_GAIN_POINTS);
+    }
+  }
+}
+
+void ayumi_tone_cache_reset(struct ayumi_tone_cache* cache) {
+  /* the tone tables stay valid for their keys, and the fixed tables for good */
+  memset(cache, 0, offsetof(struct ayumi_tone_cache, table_period));
+}
+
+static int tone_cache_matches(const struct ayumi* ay, const struct ayumi_tone_cache* cache) {
+  int i;
+  const struct tone_channel* ch;
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    ch = &ay->channels[i];
+    if (ch->tone_period != cache->tone_period[i] || ch->volume != cache->volume[i]
+      || (ch->t_off | ch->n_off << 1 | (ch->e_on != 0) << 2) != cache->mixer[i]
+      || ch->pan_left != cache->pan_left[i] || ch->pan_right != cache->pan_right[i]) {
+      return 0;
+    }
+  }
+  /* (a clock change may switch the oversampling factor and keep the step) */
+  if (ay->step != cache->step || ay->decimate_factor != cache->decimate_factor || ay->dac_table != cache->dac_table) {
+    return 0;
+  }
+  /* the generators are frozen while the cache is active, so any change to them is a register write. */
+  return !cache->active || (ay->noise_period == cache->noise_period && ay->envelope_period == cache->envelope_period
+    && ay->envelope_shape == cache->envelope_shape && ay->envelope_segment == cache->envelope_segment
+    && ay->envelope_counter == cache->envelope_counter && ay->envelope == cache->envelope);
+}
+
+static void tone_cache_store(const struct ayumi* ay, struct ayumi_tone_cache* cache) {
+  int i;
+  const struct tone_channel* ch;
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    ch = &ay->channels[i];
+    cache->tone_period[i] = ch->tone_period;
+    cache->volume[i] = ch->volume;
+    cache->mixer[i] = ch->t_off | ch->n_off << 1 | (ch->e_on != 0) << 2;
+    cache->pan_left[i] = ch->pan_left;
+    cache->pan_right[i] = ch->pan_right;
+  }
+  cache->step = ay->step;
+  cache->decimate_factor = ay->decimate_factor;
+  cache->dac_table = ay->dac_table;
+  cache->noise_period = ay->noise_period;
+  cache->envelope_period = ay->envelope_period;
+  cache->envelope_shape = ay->envelope_shape;
+  cache->envelope_segment = ay->envelope_segment;
+  cache->envelope_counter = ay->envelope_counter;
+  cache->envelope = ay->envelope;
+}
+
+/* The decimator gain at `f` (below the cutoff) cycles per output frame, interpolated from the fixed table. */
+static double tone_cache_gain(const struct ayumi* ay, const struct ayumi_tone_cache* cache, double f) {
+  const double* gain = cache->decimator_gain[factor_index(ay)];
+  double pos = f * (TONE_CACHE_GAIN_POINTS / TONE_CACHE_CUTOFF);
+  int index = (int) pos;
+  return gain[index] + (gain[index + 1] - gain[index]) * (pos - index);
+}
+
+/* One period of a square wave of amplitude 1 (-0.5 in the first half, as the tone starts low), with the harmonics
+   shaped like the interpolator (a [1/4 1/2 1/4] smoother at the tick rate) and the decimator shape them.
+   Harmonic k of the table is sampled at multiples of k of the sine period. */
+static void tone_cache_build(const struct ayumi* ay, struct ayumi_tone_cache* cache, double* table, int period,
+                             double cycles_per_frame) {
+  int i;
+  int k;
+  int p;
+  double a;
+  memset(table, 0, sizeof(cache->tables[0]));
+  for (k = 1; k * cycles_per_frame < TONE_CACHE_CUTOFF && k < TONE_CACHE_SIZE / 2; k += 2) {
+    a = -2 / (AYUMI_PI * k) * tone_cache_gain(ay, cache, k * cycles_per_frame)
+      * (0.5 + 0.5 * cos(AYUMI_PI * k / period));
+    for (i = 0, p = 0; i < TONE_CACHE_SIZE / 2; i += 1, p = (p + k) & (TONE_CACHE_SIZE - 1)) {
+      table[i] += a * cache->sine[p];
+    }
+  }
+  /* odd harmonics only: the second half is the negated first half. */
+  for (i = 0; i < TONE_CACHE_SIZE / 2; i += 1) {
+    table[i + TONE_CACHE_SIZE / 2] = -table[i];
+  }
+  table[TONE_CACHE_SIZE] = table[0];
+}
+
+/* Finds the table for `period` at the current rate, or builds it over the least recently used one that is not
+   taken by the first `taken` channels. */
+static const double* tone_cache_table(const struct ayumi* ay, struct ayumi_tone_cache* cache, int period,
+                                      double cycles_per_frame, int taken) {
+  int i;
+  int j;
+  int slot = -1;
+  for (i = 0; i < TONE_CACHE_TABLES; i += 1) {
+    if (cache->table_period[i] == period && cache->table_step[i] == ay->step
+      && cache->table_factor[i] == ay->decimate_factor) {
+      cache->table_used[i] = ++cache->table_clock;
+      return cache->tables[i];
+    }
+  }
+  for (i = 0; i < TONE_CACHE_TABLES; i += 1) {
+    for (j = 0; j < taken; j += 1) {
+      if (cache->table[j] == cache->tables[i]) {
+        break;
+      }
+    }
+    if (j == taken && (slot < 0 || cache->table_used[i] < cache->table_used[slot])) {
+      slot = i;
+    }
+  }
+  tone_cache_build(ay, cache, cache->tables[slot], period, cycles_per_frame);
+  cache->table_period[slot] = period;
+  cache->table_step[slot] = ay->step;
+  cache->table_factor[slot] = ay->decimate_factor;
+  cache->table_used[slot] = ++cache->table_clock;
+  return cache->tables[slot];
+}
+
+static int tone_cache_enter(struct ayumi* ay, struct ayumi_tone_cache* cache) {
+  int i;
+  double level;
+  double ticks_per_frame = ay->step * ay->decimate_factor;
+  /* the tone edges come out of the interpolator and the FIR this many ticks later */
+  double delay = FIR_FRAMES / 2 * ticks_per_frame + INTERPOLATOR_DELAY;
+  struct tone_channel* ch;
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    ch = &ay->channels[i];
+    if (ch->e_on || !(ch->n_off || ch->volume == 0)
+      || (!ch->t_off && 2 * ch->tone_period > TONE_CACHE_SIZE * ticks_per_frame)) {
+      return 0;
+    }
+  }
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    ch = &ay->channels[i];
+    level = ay->dac_table[ch->volume * 2 + 1];
+    cache->level[i] = 0;
+    cache->offset[i] = ch->volume == 0 ? 0 : level;
+    cache->table[i] = NULL;
+    if (ch->t_off || ch->volume == 0) {
+      continue;
+    }
+    cache->level[i] = level;
+    cache->offset[i] = level * 0.5;
+    cache->phase_step[i] = ticks_per_frame / (2 * ch->tone_period);
+    cache->table[i] = tone_cache_table(ay, cache, ch->tone_period, cache->phase_step[i], i);
+    cache->phase[i] = (ch->tone_counter + ch->tone * ch->tone_period + ay->x - delay) / (2 * ch->tone_period);
+    cache->phase[i] -= floor(cache->phase[i]);
+  }
+  cache->preroll = ayumi_preroll_frames(ay);
+  cache->lag = 0;
+  cache->pending_ticks = 0;
+  cache->active = 1;
+  tone_cache_store(ay, cache);
+  return 1;
+}
+
+/* Brings the chip to the current position with the settings it had while cached, then applies the new ones. */
+static void tone_cache_leave(struct ayumi* ay, struct ayumi_tone_cache* cache) {
+  int i;
+  struct tone_channel channels[TONE_CHANNELS];
+  int noise_period = ay->noise_period;
+  int envelope_period = ay->envelope_period;
+  int envelope_shape = ay->envelope_shape;
+  int envelope_segment = ay->envelope_segment;
+  int envelope_counter = ay->envelope_counter;
+  int envelope = ay->envelope;
+  double step = ay->step;
+  const double* dac_table = ay->dac_table;
+  int restarted = envelope_shape != cache->envelope_shape || envelope_segment != cache->envelope_segment
+    || envelope_counter != cache->envelope_counter || envelope != cache->envelope;
+  memcpy(channels, ay->channels, sizeof(channels));
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    ay->channels[i].tone_period = cache->tone_period[i];
+    ay->channels[i].volume = cache->volume[i];
+    ay->channels[i].t_off = cache->mixer[i] & 1;
+    ay->channels[i].n_off = (cache->mixer[i] >> 1) & 1;
+    ay->channels[i].e_on = (cache->mixer[i] >> 2) & 1;
+    ay->channels[i].pan_left = cache->pan_left[i];
+    ay->channels[i].pan_right = cache->pan_right[i];
+  }
+  ay->noise_period = cache->noise_period;
+  ay->envelope_period = cache->envelope_period;
+  ay->envelope_shape = cache->envelope_shape;
+  ay->envelope_segment = cache->envelope_segment;
+  ay->envelope_counter = cache->envelope_counter;
+  ay->envelope = cache->envelope;
+  /* at the old rate in ticks per frame, also if the oversampling factor has changed since (exact, as the factors
+     are powers of 2) */
+  ay->step = cache->step * cache->decimate_factor / ay->decimate_factor;
+  ay->dac_table = cache->dac_table;
+
+  ayumi_advance(ay, cache->pending_ticks);
+  for (i = 0; i < cache->lag; i += 1) {
+    ayumi_process(ay);
+  }
+
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    ay->channels[i].tone_period = channels[i].tone_period;
+    ay->channels[i].volume = channels[i].volume;
+    ay->channels[i].t_off = channels[i].t_off;
+    ay->channels[i].n_off = channels[i].n_off;
+    ay->channels[i].e_on = channels[i].e_on;
+    ay->channels[i].pan_left = channels[i].pan_left;
+    ay->channels[i].pan_right = channels[i].pan_right;
+  }
+  ay->noise_period = noise_period;
+  ay->envelope_period = envelope_period;
+  if (restarted) {
+    ay->envelope_shape = envelope_shape;
+    ay->envelope_segment = envelope_segment;
+    ay->envelope_counter = envelope_counter;
+    ay->envelope = envelope;
+  }
+  ay->step = step;
+  ay->dac_table = dac_table;
+  cache->active = 0;
+}
+
+static void tone_cache_process(struct ayumi* ay, struct ayumi_tone_cache* cache) {
+  int i;
+  double v;
+  double pos;
+  int index;
+  const double* table;
+  if (cache->lag < cache->preroll) {
+    cache->lag += 1;
+  } else {
+    for (i = 0; i < ay->decimate_factor; i += 1) {
+      ay->x += ay->step;
+      if (ay->x >= 1) {
+        ay->x -= 1;
+        cache->pending_ticks += 1;
+      }
+    }
+    ay->fir_index = (ay->fir_index + 1) % (FIR_FRAMES - 1);
+  }
+  ay->left = 0;
+  ay->right = 0;
+  for (i = 0; i < TONE_CHANNELS; i += 1) {
+    v = cache->offset[i];
+    if (cache->level[i] != 0) {
+      cache->phase[i] += cache->phase_step[i];
+      if (cache->phase[i] >= 1) {
+        cache->phase[i] -= floor(cache->phase[i]);
+      }
+      pos = cache->phase[i] * TONE_CACHE_SIZE;
+      index = (int) pos;
+      table = &cache->table[i][index];
+      v += cache->level[i] * (table[0] + (table[1] - table[0]) * (pos - index));
+    }
+    ay->left += v * cache->pan_left[i];
+    ay->right += v * cache->pan_right[i];
+  }
+}
+
+void ayumi_tone_cache_flush(struct ayumi* ay, struct ayumi_tone_cache* cache) {
+  if (cache->active) {
+    tone_cache_leave(ay, cache);
+  }
+  cache->steady_frames = 0;
+}
+
+void ayumi_process_cached(struct ayumi* ay, struct ayumi_tone_cache* cache) {
+  if (cache->active && !tone_cache_matches(ay, cache)) {
+    tone_cache_leave(ay, cache);
+  }
+  if (!cache->active) {
+    if (!tone_cache_matches(ay, cache)) {
+      tone_cache_store(ay, cache);
+      cache->steady_frames = 0;
+    } else if (cache->steady_frames < FIR_SIZE) {
+      cache->steady_frames += 1;
+    }
+    /* the FIR has to hold the steady signal only before it is replaced with the cache. */
+    if (cache->steady_frames < ayumi_preroll_frames(ay) || !tone_cache_enter(ay, cache)) {
+      ayumi_process(ay);
+      return;
+    }
+  }
+  tone_cache_process(ay, cache);
 }
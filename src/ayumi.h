@@ -5,9 +5,22 @@
 
 enum {
   TONE_CHANNELS = 3,
-  DECIMATE_FACTOR = 8,
-  FIR_SIZE = 192,
-  DC_FILTER_SIZE = 1024
+  DECIMATE_FACTOR = 8, /* the largest oversampling factor; 4 and 2 are used when the output rate allows */
+  MIN_DECIMATE_FACTOR = 2,
+  FIR_SIZE = 192, /* at DECIMATE_FACTOR */
+  FIR_FRAMES = FIR_SIZE / DECIMATE_FACTOR, /* the span of the decimation FIR in output frames */
+  DC_FILTER_SIZE = 1024,
+  TONE_CACHE_SIZE = 1024,
+  TONE_CACHE_TABLES = 8, /* tone tables kept by the cache, so that alternating notes do not rebuild them */
+  TONE_CACHE_GAIN_POINTS = 1024 /* decimator gain samples up to the cache cutoff */
+};
+
+/* Engine quality tiers, from the most accurate to the cheapest */
+enum {
+  AYUMI_QUALITY_FULL = 0, /* 192-tap decimation FIR (at 8x), moving-average DC filter */
+  AYUMI_QUALITY_REDUCED = 1, /* 63-tap decimation FIR (at 8x) */
+  AYUMI_QUALITY_LOW = 2, /* 31-tap decimation FIR (at 8x), one-pole DC filter */
+  AYUMI_QUALITY_TIERS = 3
 };
 
 struct tone_channel {
@@ -32,6 +45,17 @@ struct dc_filter {
   double delay[DC_FILTER_SIZE];
 };
 
+struct ayumi_stem {
+  struct interpolator interpolator_left;
+  struct interpolator interpolator_right;
+  double fir_left[FIR_SIZE * 2];
+  double fir_right[FIR_SIZE * 2];
+  struct dc_filter dc_left;
+  struct dc_filter dc_right;
+  double left;
+  double right;
+};
+
 struct ayumi {
   struct tone_channel channels[TONE_CHANNELS];
   int noise_period;
@@ -53,11 +77,72 @@ struct ayumi {
   struct dc_filter dc_left;
   struct dc_filter dc_right;
   int dc_index;
+  int quality;
+  int low_latency;
+  int decimate_factor;
   double left;
   double right;
 };
 
+/* Cache of the output of steady tone-only channels. When every channel is a pure tone (noise and envelope off)
+   or constant, the output is periodic; one band-limited period of each tone is kept and played back with
+   fractional phase instead of emulating the chip. The tables depend on the tone period and the rate only;
+   volume and pan are applied as gains. */
+struct ayumi_tone_cache {
+  /* the settings the cache was built for */
+  int tone_period[TONE_CHANNELS];
+  int mixer[TONE_CHANNELS];
+  int volume[TONE_CHANNELS];
+  double pan_left[TONE_CHANNELS];
+  double pan_right[TONE_CHANNELS];
+  int noise_period;
+  int envelope_period;
+  int envelope_shape;
+  int envelope_segment;
+  int envelope_counter;
+  int envelope;
+  const double* dac_table;
+  double step;
+  int decimate_factor;
+  int steady_frames;
+  int active;
+  /* while active, the chip itself stays `lag` frames behind (up to the pre-roll), and its generators are
+     advanced by `pending_ticks` when leaving, before the pre-roll is rendered to rebuild the filter history. */
+  int lag;
+  int preroll;
+  long long pending_ticks;
+  double phase[TONE_CHANNELS];
+  double phase_step[TONE_CHANNELS];
+  double level[TONE_CHANNELS]; /* amplitude of the tone (0 if the channel is constant) */
+  double offset[TONE_CHANNELS]; /* constant part of the channel output */
+  const double* table[TONE_CHANNELS];
+  /* the tone tables, keyed on the tone period, the step and the oversampling factor (period 0 if unused) */
+  int table_period[TONE_CACHE_TABLES];
+  double table_step[TONE_CACHE_TABLES];
+  int table_factor[TONE_CACHE_TABLES];
+  unsigned table_used[TONE_CACHE_TABLES]; /* for replacing the least recently used one */
+  unsigned table_clock;
+  double tables[TONE_CACHE_TABLES][TONE_CACHE_SIZE + 1];
+  /* filled by ayumi_tone_cache_init() and kept by ayumi_tone_cache_reset(): one period of a sine, and the gain of
+     the full quality decimator by oversampling factor (8x, 4x, 2x), from 0 to the cutoff frequency. */
+  double sine[TONE_CACHE_SIZE];
+  double decimator_gain[3][TONE_CACHE_GAIN_POINTS + 1];
+};
+
+/* Complete chip and filter state as plain data (the DAC table is kept as a flag instead of a pointer) */
+struct ayumi_snapshot {
+  struct ayumi ay;
+  int is_ym;
+};
+
+/* Both pick the least oversampling (DECIMATE_FACTOR, 4 or 2) that still has an internal sample per chip tick,
+   and return zero if even DECIMATE_FACTOR does not. When the factor changes, the FIR histories (of the `stems`
+   as well, which may be NULL) are replaced with the current levels. */
 int ayumi_configure(struct ayumi* ay, int is_ym, double clock_rate, int sr);
+int ayumi_reconfigure(struct ayumi* ay, struct ayumi_stem* stems, int is_ym, double clock_rate, int sr);
+/* Overrides the oversampling factor picked by ayumi_configure() (2, 4 or 8), like ayumi_reconfigure() does with
+   the FIR histories. Returns zero if the factor is not supported. */
+int ayumi_set_decimate_factor(struct ayumi* ay, struct ayumi_stem* stems, int factor);
 void ayumi_set_pan(struct ayumi* ay, int index, double pan, int is_eqp);
 void ayumi_set_tone(struct ayumi* ay, int index, int period);
 void ayumi_set_noise(struct ayumi* ay, int period);
@@ -67,5 +152,41 @@ void ayumi_set_envelope(struct ayumi* ay, int period);
 void ayumi_set_envelope_shape(struct ayumi* ay, int shape);
 void ayumi_process(struct ayumi* ay);
 void ayumi_remove_dc(struct ayumi* ay);
+void ayumi_process_mono(struct ayumi* ay);
+void ayumi_remove_dc_mono(struct ayumi* ay);
+void ayumi_process_stems(struct ayumi* ay, struct ayumi_stem* stems);
+void ayumi_remove_dc_stems(struct ayumi* ay, struct ayumi_stem* stems);
+/* Switches the quality tier (AYUMI_QUALITY_*) without discontinuities; `stems` may be NULL. The decimation FIRs
+   keep the same delay in every tier. */
+void ayumi_set_quality(struct ayumi* ay, struct ayumi_stem* stems, int quality);
+/* Switches the decimation FIRs to minimum-phase ones, which cut the latency from about 12 frames to about 2-4
+   frames (see ayumi_latency()) at the cost of phase linearity. Switching while playing is audible, as the delay
+   changes. Not for use with the tone cache, which assumes the linear-phase filters. */
+void ayumi_set_low_latency(struct ayumi* ay, int enabled);
+/* Delay from a register write to the output, in (fractional) output frames: the decimation FIR (its group delay
+   at low frequencies for the minimum-phase ones) and the interpolator. For plugin delay compensation. */
+double ayumi_latency(const struct ayumi* ay);
+/* Advances the chip by `frames` output frames without producing any output. The generators are advanced in
+   closed form; the phase accumulator is too when its step is a multiple of 2^-52, and is stepped (without any
+   filtering) otherwise. The interpolator, FIR and DC filter histories are left stale; after
+   ayumi_preroll_frames() frames of processing the output is identical to continuous processing, except for the DC
+   filter, which needs its next resync after DC_FILTER_SIZE more frames (when dc_index wraps around). */
+void ayumi_fast_forward(struct ayumi* ay, int frames);
+/* Advances the tone, noise and envelope generators by `ticks` chip ticks (clock_rate / 8) in closed form. */
+void ayumi_advance(struct ayumi* ay, long long ticks);
+int ayumi_preroll_frames(const struct ayumi* ay);
+/* Same as ayumi_process(), but renders from the cache while the chip is steady and tone-only (an approximation
+   of the emulated output), and falls back to emulation as soon as any setting changes. */
+void ayumi_process_cached(struct ayumi* ay, struct ayumi_tone_cache* cache);
+/* Resets the cache and fills its fixed tables. Evaluates the decimators a few thousand times, so it is meant for
+   setup rather than the audio thread. */
+void ayumi_tone_cache_init(struct ayumi_tone_cache* cache);
+/* Resets the cache state only, for use on the audio thread (after ayumi_tone_cache_init()). */
+void ayumi_tone_cache_reset(struct ayumi_tone_cache* cache);
+/* Brings the chip (which lags behind while the cache is active) up to date. Needed before the chip state is
+   used or changed other than through the setters, e.g. by ayumi_fast_forward() or ayumi_save(). */
+void ayumi_tone_cache_flush(struct ayumi* ay, struct ayumi_tone_cache* cache);
+void ayumi_save(const struct ayumi* ay, struct ayumi_snapshot* snapshot);
+void ayumi_restore(struct ayumi* ay, const struct ayumi_snapshot* snapshot);
 
 #endif
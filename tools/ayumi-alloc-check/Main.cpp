@@ -0,0 +1,311 @@
+/*
+  ==============================================================================
+
+    ayumi-alloc-check: drives AyumiAudioProcessor with stress MIDI scenarios
+    through both processBlock() and processUmpBlock(), and fails if either
+    of them allocates or locks. Global operator new (and malloc, calloc and
+    realloc with glibc) are replaced, and count what a thread allocates
+    while it is inside the processor; with glibc, so are the pthread mutex,
+    rwlock and condition variable waits and the semaphore waits, which
+    count the locks it takes.
+
+  ==============================================================================
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+#if defined(__GLIBC__)
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+#include <juce_core/juce_core.h>
+#include <juce_events/juce_events.h>
+#include "PluginProcessor.h"
+#include "Scenarios.h"
+#include "cmidi2.h"
+
+static thread_local bool inAudioCallback = false;
+static std::atomic<int> audioAllocations{0};
+static std::atomic<size_t> firstAllocationSize{0};
+
+static void noteAllocation(size_t size)
+{
+    if (inAudioCallback && audioAllocations++ == 0)
+        firstAllocationSize = size;
+}
+
+#if defined(__GLIBC__)
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* p, size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+    noteAllocation(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+    noteAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* p, size_t size)
+{
+    noteAllocation(size);
+    return __libc_realloc(p, size);
+}
+
+static void* allocate(size_t size) { return __libc_malloc(size); }
+#else
+static void* allocate(size_t size) { return std::malloc(size); }
+#endif
+
+void* operator new(std::size_t size)
+{
+    noteAllocation(size);
+    if (auto p = allocate(size > 0 ? size : 1))
+        return p;
+    throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    noteAllocation(size);
+    return allocate(size > 0 ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+static std::atomic<int> audioLocks{0};
+static std::atomic<const char*> firstLock{nullptr};
+
+static void noteLock(const char* name)
+{
+    if (inAudioCallback && audioLocks++ == 0)
+        firstLock = name;
+}
+
+#if defined(__GLIBC__)
+// The blocking primitives of the C library are replaced by ones that count the call and forward it to the next
+// definition, looked up once. Try-locks count as well: they are not taken on the audio thread by design either
+// (juce::SpinLock, which the processor try-locks, spins on an atomic and is not counted). Raw futex system calls
+// (e.g. std::atomic::wait()) cannot be interposed this way and are not detected.
+template <typename Function, typename... Args>
+static int forwardLock(std::atomic<void*>& next, const char* name, Args... args)
+{
+    noteLock(name);
+    auto function = next.load(std::memory_order_acquire);
+    if (function == nullptr) {
+        function = dlsym(RTLD_NEXT, name);
+        next.store(function, std::memory_order_release);
+    }
+    return ((Function) function)(args...);
+}
+
+#define AYUMI_LOCK_HOOK(name, Parameter) \
+    extern "C" int name(Parameter p) \
+    { \
+        static std::atomic<void*> next{nullptr}; \
+        return forwardLock<int (*)(Parameter)>(next, #name, p); \
+    }
+
+AYUMI_LOCK_HOOK(pthread_mutex_lock, pthread_mutex_t*)
+AYUMI_LOCK_HOOK(pthread_mutex_trylock, pthread_mutex_t*)
+AYUMI_LOCK_HOOK(pthread_rwlock_rdlock, pthread_rwlock_t*)
+AYUMI_LOCK_HOOK(pthread_rwlock_wrlock, pthread_rwlock_t*)
+AYUMI_LOCK_HOOK(pthread_rwlock_tryrdlock, pthread_rwlock_t*)
+AYUMI_LOCK_HOOK(pthread_rwlock_trywrlock, pthread_rwlock_t*)
+AYUMI_LOCK_HOOK(sem_wait, sem_t*)
+AYUMI_LOCK_HOOK(sem_trywait, sem_t*)
+
+extern "C" int pthread_mutex_timedlock(pthread_mutex_t* m, const struct timespec* t)
+{
+    static std::atomic<void*> next{nullptr};
+    return forwardLock<int (*)(pthread_mutex_t*, const struct timespec*)>(next, "pthread_mutex_timedlock", m, t);
+}
+
+extern "C" int pthread_cond_wait(pthread_cond_t* c, pthread_mutex_t* m)
+{
+    static std::atomic<void*> next{nullptr};
+    return forwardLock<int (*)(pthread_cond_t*, pthread_mutex_t*)>(next, "pthread_cond_wait", c, m);
+}
+
+extern "C" int pthread_cond_timedwait(pthread_cond_t* c, pthread_mutex_t* m, const struct timespec* t)
+{
+    static std::atomic<void*> next{nullptr};
+    return forwardLock<int (*)(pthread_cond_t*, pthread_mutex_t*, const struct timespec*)>(next, "pthread_cond_timedwait", c, m, t);
+}
+
+#if __GLIBC_PREREQ(2, 30)
+extern "C" int pthread_cond_clockwait(pthread_cond_t* c, pthread_mutex_t* m, clockid_t clock, const struct timespec* t)
+{
+    static std::atomic<void*> next{nullptr};
+    return forwardLock<int (*)(pthread_cond_t*, pthread_mutex_t*, clockid_t, const struct timespec*)>(
+            next, "pthread_cond_clockwait", c, m, clock, t);
+}
+#endif
+#endif
+
+struct Options {
+    double sampleRate{48000};
+    double seconds{2};
+    std::vector<int> blockSizes{32, 256, 1024};
+};
+
+// The events of a block as UMPs: each one preceded by a JR Timestamp of its delta time from the previous one.
+static void fillUmpBuffer(const juce::MidiBuffer& midi, double sampleRate, std::vector<uint32_t>& ump)
+{
+    ump.clear();
+    int previous = 0;
+    for (const auto metadata : midi) {
+        auto delta = (metadata.samplePosition - previous) * JR_TIMESTAMP_TICKS_PER_SECOND / sampleRate;
+        ump.push_back(cmidi2_ump_jr_timestamp_direct(0, (uint32_t) juce::roundToInt(delta)));
+        previous = metadata.samplePosition;
+        auto data = metadata.data;
+        if (data[0] == 0xF0) {
+            std::vector<uint8_t> sysex{data, data + metadata.numBytes};
+            cmidi2_ump_sysex7_process(0, sysex.data(), [](uint64_t packet, void* context) {
+                auto out = (std::vector<uint32_t>*) context;
+                out->push_back((uint32_t) (packet >> 32));
+                out->push_back((uint32_t) packet);
+            }, &ump);
+        } else
+            ump.push_back((uint32_t) cmidi2_ump_midi1_message(0, data[0] & 0xF0, data[0] & 0xF,
+                                                              metadata.numBytes > 1 ? data[1] : 0,
+                                                              metadata.numBytes > 2 ? data[2] : 0));
+    }
+}
+
+// Plays `scenario` through processBlock() (or processUmpBlock()) and returns the number of allocations made inside;
+// the locks taken inside are counted in audioLocks.
+// A `governorBudget` too small to meet makes the governor step the quality down while playing; the tier at the end
+// is returned in `qualityTier`.
+static int run(const Options& options, const Scenario& scenario, int blockSize, bool ump, juce::int64 length,
+               double governorBudget, int& qualityTier)
+{
+    AyumiAudioProcessor processor;
+    processor.setNonRealtime(false);
+    processor.setGovernorBudget(governorBudget);
+    processor.setRateAndBufferSizeDetails(options.sampleRate, blockSize);
+    processor.prepareToPlay(options.sampleRate, blockSize);
+
+    juce::AudioBuffer<float> buffer{processor.getTotalNumOutputChannels(), blockSize};
+    juce::MidiBuffer midi;
+    std::vector<uint32_t> umpBuffer;
+    int nextEvent = 0;
+    audioAllocations = 0;
+    audioLocks = 0;
+    for (juce::int64 position = 0; position < length; position += blockSize) {
+        fillMidiBuffer(scenario.sequence, midi, nextEvent, position, blockSize);
+        if (ump)
+            fillUmpBuffer(midi, options.sampleRate, umpBuffer);
+        buffer.clear();
+        inAudioCallback = true;
+        if (ump)
+            processor.processUmpBlock(buffer, umpBuffer.data(), (int) umpBuffer.size());
+        else
+            processor.processBlock(buffer, midi);
+        inAudioCallback = false;
+    }
+    qualityTier = processor.getQualityTier();
+    processor.releaseResources();
+    return audioAllocations;
+}
+
+static void printUsage()
+{
+    std::cerr << "Usage: ayumi-alloc-check [options]" << std::endl
+              << "Options:" << std::endl
+              << "  -r, --sample-rate N    sample rate (default: 48000)" << std::endl
+              << "  -d, --duration SECONDS audio length rendered per run (default: 2)" << std::endl
+              << "  -b, --block-size N     buffer size, can be repeated (default: 32, 256 and 1024)" << std::endl
+              << "Plays the cc-storm, arpeggio and sysex scenarios through processBlock() and processUmpBlock()," << std::endl
+              << "once as is and once with the CPU budget governor stepping the quality down, and exits with a" << std::endl
+              << "non-zero status if any of them allocates memory or takes a lock." << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    Options options;
+    bool blockSizesGiven = false;
+    for (int i = 1; i < argc; i++) {
+        juce::String arg{argv[i]};
+        bool hasValue = i + 1 < argc;
+        if ((arg == "-r" || arg == "--sample-rate") && hasValue)
+            options.sampleRate = juce::String(argv[++i]).getDoubleValue();
+        else if ((arg == "-d" || arg == "--duration") && hasValue)
+            options.seconds = juce::String(argv[++i]).getDoubleValue();
+        else if ((arg == "-b" || arg == "--block-size") && hasValue) {
+            if (!blockSizesGiven)
+                options.blockSizes.clear();
+            blockSizesGiven = true;
+            options.blockSizes.push_back(juce::String(argv[++i]).getIntValue());
+        } else {
+            printUsage();
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+    if (options.sampleRate <= 0 || options.seconds <= 0
+        || std::any_of(options.blockSizes.begin(), options.blockSizes.end(), [](int b) { return b <= 0; })) {
+        printUsage();
+        return 1;
+    }
+
+    auto length = (juce::int64) (options.seconds * options.sampleRate);
+    int failures = 0;
+    for (auto& scenario : createScenarios(options.sampleRate, length)) {
+        juce::String name{scenario.name};
+        if (name != "cc-storm" && name != "arpeggio" && name != "sysex")
+            continue;
+        for (auto blockSize : options.blockSizes) {
+            for (bool ump : {false, true}) {
+                for (bool governor : {false, true}) {
+                    int qualityTier;
+                    auto allocations = run(options, scenario, blockSize, ump, length,
+                                           governor ? 1e-9 : AYUMI_GOVERNOR_DEFAULT_BUDGET, qualityTier);
+                    // the governor run has to change the tier, or it did not test anything.
+                    bool stepped = !governor || qualityTier != AYUMI_QUALITY_FULL;
+                    int locks = audioLocks;
+                    bool ok = allocations == 0 && locks == 0 && stepped;
+                    std::cout << (ok ? "PASS " : "FAIL ") << scenario.name << " "
+                              << (ump ? "processUmpBlock" : "processBlock") << " block " << blockSize
+                              << (governor ? " governor" : "");
+                    if (allocations > 0)
+                        std::cout << ": " << allocations << " allocation(s), the first of "
+                                  << firstAllocationSize << " bytes";
+                    if (locks > 0)
+                        std::cout << (allocations > 0 ? "," : ":") << " " << locks << " lock(s), the first "
+                                  << firstLock.load() << "()";
+                    if (!stepped)
+                        std::cout << (allocations > 0 || locks > 0 ? "," : ":") << " the governor did not step down";
+                    std::cout << std::endl;
+                    failures += !ok;
+                }
+            }
+        }
+    }
+    std::cout << failures << " failure(s)" << std::endl;
+    return failures > 0 ? 1 : 0;
+}
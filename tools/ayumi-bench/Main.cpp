@@ -0,0 +1,259 @@
+/*
+  ==============================================================================
+
+    ayumi-bench: microbenchmarks for the ayumi core, independent of JUCE.
+
+    ayumi.cpp is compiled into this file, so that the static kernels
+    (decimate() and its shorter variants, update_mixer()) can be timed on their own as well.
+    Results are written as JSON to the standard output.
+
+  ==============================================================================
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include "../../src/ayumi.cpp"
+
+struct Settings {
+    const char* name;
+    // t_off, n_off, e_on for all channels
+    int t_off;
+    int n_off;
+    int e_on;
+};
+
+static const Settings allSettings[] = {
+    {"tone", 0, 1, 0},
+    {"noise", 1, 0, 0},
+    {"envelope", 0, 1, 1},
+    {"tone+noise", 0, 0, 0},
+};
+
+static const double clockRates[] = {1000000, 1773400, 2000000, 4000000, 8000000, 16000000};
+static const int sampleRates[] = {44100, 48000, 96000, 192000};
+
+// the results are accumulated here, so that the compiler cannot drop the work.
+static volatile double sink;
+
+struct Options {
+    int frames{20000};
+    int repeats{5};
+};
+
+// Returns the fastest of the repeats, in nanoseconds per iteration.
+static double measure(const Options& options, int iterations, const std::function<void()>& setup,
+                      const std::function<void(int)>& run)
+{
+    double best = 1e300;
+    for (int r = 0; r < options.repeats; r++) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        run(iterations);
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count() / iterations);
+    }
+    return best;
+}
+
+static bool configure(struct ayumi* ay, const Settings& settings, double clockRate, int sampleRate)
+{
+    // ayumi_configure() returns 0 if the clock is too fast for the rate.
+    if (!ayumi_configure(ay, 1, clockRate, sampleRate))
+        return false;
+    for (int i = 0; i < TONE_CHANNELS; i++) {
+        ayumi_set_pan(ay, i, 0.25 * (i + 1), 0);
+        ayumi_set_mixer(ay, i, settings.t_off, settings.n_off, settings.e_on);
+        ayumi_set_tone(ay, i, 200 + 73 * i);
+        ayumi_set_volume(ay, i, 13);
+    }
+    ayumi_set_noise(ay, 7);
+    ayumi_set_envelope(ay, 0x40);
+    ayumi_set_envelope_shape(ay, 14);
+    return true;
+}
+
+struct Result {
+    std::string kernel;
+    std::string settings;
+    double clockRate;
+    int sampleRate;
+    const char* unit;
+    double ns;
+    double ticksPerIteration;
+};
+
+// clock and sample rate combinations ayumi does not support (more than one chip tick per FIR sample).
+struct Skipped {
+    double clockRate;
+    int sampleRate;
+};
+
+static void writeJson(const Options& options, const std::vector<Result>& results, const std::vector<Skipped>& skipped)
+{
+    printf("{\n  \"benchmark\": \"ayumi-kernels\",\n  \"version\": 1,\n");
+    printf("  \"frames\": %d,\n  \"repeats\": %d,\n  \"results\": [\n", options.frames, options.repeats);
+    for (size_t i = 0; i < results.size(); i++) {
+        auto& r = results[i];
+        printf("    {\"kernel\": \"%s\", \"settings\": \"%s\", \"clock_rate\": %.0f, \"sample_rate\": %d, "
+               "\"ns_per_%s\": %.3f, \"chip_ticks_per_second\": %.0f}%s\n",
+               r.kernel.c_str(), r.settings.c_str(), r.clockRate, r.sampleRate, r.unit, r.ns,
+               r.ticksPerIteration * 1e9 / r.ns, i + 1 < results.size() ? "," : "");
+    }
+    printf("  ],\n  \"unsupported\": [");
+    for (size_t i = 0; i < skipped.size(); i++)
+        printf("%s{\"clock_rate\": %.0f, \"sample_rate\": %d}", i > 0 ? ", " : "", skipped[i].clockRate, skipped[i].sampleRate);
+    printf("]\n}\n");
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg{argv[i]};
+        if ((arg == "-n" || arg == "--frames") && i + 1 < argc)
+            options.frames = std::max(1, atoi(argv[++i]));
+        else if ((arg == "-r" || arg == "--repeats") && i + 1 < argc)
+            options.repeats = std::max(1, atoi(argv[++i]));
+        else {
+            fprintf(stderr, "Usage: ayumi-bench [-n|--frames N (default: 20000)] [-r|--repeats N (default: 5)]\n"
+                            "Times the ayumi core kernels and writes the results as JSON to the standard output.\n");
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+
+    std::vector<Result> results;
+    std::vector<Skipped> skipped;
+    static struct ayumi ay;
+    static struct ayumi_stem stems[TONE_CHANNELS];
+    static struct ayumi_tone_cache cache;
+    ayumi_tone_cache_init(&cache);
+
+    for (auto& settings : allSettings) {
+        for (auto clockRate : clockRates) {
+            for (auto sampleRate : sampleRates) {
+                if (!configure(&ay, settings, clockRate, sampleRate)) {
+                    if (&settings == allSettings)
+                        skipped.push_back({clockRate, sampleRate});
+                    continue;
+                }
+                double ticksPerFrame = ay.step * ay.decimate_factor;
+                auto reset = [&]() {
+                    configure(&ay, settings, clockRate, sampleRate);
+                    memset(stems, 0, sizeof(stems));
+                    ayumi_tone_cache_reset(&cache);
+                };
+                auto add = [&](const char* kernel, const std::function<void(int)>& run) {
+                    results.push_back({kernel, settings.name, clockRate, sampleRate, "frame",
+                                       measure(options, options.frames, reset, run), ticksPerFrame});
+                };
+
+                add("ayumi_process", [&](int n) {
+                    for (int i = 0; i < n; i++)
+                        ayumi_process(&ay);
+                    sink = ay.left;
+                });
+                add("ayumi_process+ayumi_remove_dc", [&](int n) {
+                    for (int i = 0; i < n; i++) {
+                        ayumi_process(&ay);
+                        ayumi_remove_dc(&ay);
+                    }
+                    sink = ay.left;
+                });
+                add("ayumi_process_mono+ayumi_remove_dc_mono", [&](int n) {
+                    for (int i = 0; i < n; i++) {
+                        ayumi_process_mono(&ay);
+                        ayumi_remove_dc_mono(&ay);
+                    }
+                    sink = ay.left;
+                });
+                add("ayumi_process_stems+ayumi_remove_dc_stems", [&](int n) {
+                    for (int i = 0; i < n; i++) {
+                        ayumi_process_stems(&ay, stems);
+                        ayumi_remove_dc_stems(&ay, stems);
+                    }
+                    sink = ay.left;
+                });
+                add("ayumi_process_cached+ayumi_remove_dc", [&](int n) {
+                    for (int i = 0; i < n; i++) {
+                        ayumi_process_cached(&ay, &cache);
+                        ayumi_remove_dc(&ay);
+                    }
+                    sink = ay.left;
+                });
+                add("ayumi_fast_forward", [&](int n) {
+                    for (int i = 0; i < n; i++)
+                        ayumi_fast_forward(&ay, 1);
+                    sink = ay.x;
+                });
+            }
+        }
+
+        // per-tick and per-call kernels, at the default rate.
+        configure(&ay, settings, 2000000, 44100);
+        auto reset = [&]() { configure(&ay, settings, 2000000, 44100); };
+        results.push_back({"update_mixer", settings.name, 2000000, 44100, "tick",
+                           measure(options, options.frames * DECIMATE_FACTOR, reset, [&](int n) {
+                               for (int i = 0; i < n; i++)
+                                   update_mixer(&ay);
+                               sink = ay.left;
+                           }), 1});
+        results.push_back({"ayumi_advance", settings.name, 2000000, 44100, "call",
+                           measure(options, options.frames, reset, [&](int n) {
+                               for (int i = 0; i < n; i++)
+                                   ayumi_advance(&ay, 1000);
+                               sink = ay.noise;
+                           }), 1000});
+    }
+
+    static double fir[FIR_SIZE * 2];
+    for (int i = 0; i < FIR_SIZE * 2; i++)
+        fir[i] = (i * 7919 % 101) / 101.0;
+    results.push_back({"decimate", "-", 0, 0, "call",
+                       measure(options, options.frames, []() {}, [&](int n) {
+                           double y = 0;
+                           for (int i = 0; i < n; i++)
+                               y += decimate(&fir[i % FIR_SIZE]);
+                           sink = y;
+                       }), 0});
+    // the shorter filters of the reduced quality tiers
+    results.push_back({"decimate_63", "-", 0, 0, "call",
+                       measure(options, options.frames, []() {}, [&](int n) {
+                           double y = 0;
+                           for (int i = 0; i < n; i++)
+                               y += decimate_63(&fir[i % FIR_SIZE]);
+                           sink = y;
+                       }), 0});
+    results.push_back({"decimate_31", "-", 0, 0, "call",
+                       measure(options, options.frames, []() {}, [&](int n) {
+                           double y = 0;
+                           for (int i = 0; i < n; i++)
+                               y += decimate_31(&fir[i % FIR_SIZE]);
+                           sink = y;
+                       }), 0});
+    // the minimum-phase filter of the low-latency mode
+    results.push_back({"decimate_min_phase_192", "-", 0, 0, "call",
+                       measure(options, options.frames, []() {}, [&](int n) {
+                           double y = 0;
+                           for (int i = 0; i < n; i++)
+                               y += decimate_min_phase_192(&fir[i % FIR_SIZE]);
+                           sink = y;
+                       }), 0});
+    configure(&ay, allSettings[0], 2000000, 44100);
+    results.push_back({"ayumi_remove_dc", "-", 0, 0, "frame",
+                       measure(options, options.frames, []() {}, [&](int n) {
+                           for (int i = 0; i < n; i++) {
+                               ay.left = ay.right = (i & 15) / 16.0;
+                               ayumi_remove_dc(&ay);
+                           }
+                           sink = ay.left;
+                       }), 0});
+
+    writeJson(options, results, skipped);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+#
+# Designs the decimation filters of src/ayumi.cpp other than the original decimate(), and prints them as C code
+# to be pasted there. Plain Python, no dependencies.
+#
+#   decimate_63(), decimate_31(): shorter Kaiser-windowed sinc filters for the lower quality tiers, centered on
+#   the same tap as decimate(), so that the tiers can be switched without changing the delay.
+#   decimate_4x_*(), decimate_2x_*(): the same three tiers for 4x and 2x oversampling, spanning the same number
+#   of output frames (the full tier is a Kaiser design matching the response of decimate()).
+#   min_phase_*: minimum-phase counterparts of all of them (same magnitude response, most of the delay removed)
+#   for the low-latency mode.
+#
+# Usage: design_decimators.py [path to ayumi.cpp] > decimators.c
+
+import cmath
+import math
+import os
+import re
+import sys
+
+DECIMATE_FACTOR = 8  # the largest one
+FIR_SIZE = 192  # at DECIMATE_FACTOR
+FIR_FRAMES = FIR_SIZE // DECIMATE_FACTOR
+CENTER = FIR_SIZE // 2
+
+# (half width at DECIMATE_FACTOR, Kaiser beta) of the quality tiers; None is decimate() itself.
+TIERS = [(None, 8.0), (31, 6.0), (15, 3.0)]
+
+
+def bessel_i0(x):
+    s = t = 1.0
+    k = 1
+    while t > 1e-20 * s:
+        t *= (x / 2 / k) ** 2
+        s += t
+        k += 1
+    return s
+
+
+# Kaiser-windowed sinc lowpass at the output Nyquist frequency, normalized to unity gain at DC.
+# Returns the 2 * half + 1 taps.
+def kaiser_lowpass(half, beta, factor=DECIMATE_FACTOR):
+    h = []
+    for n in range(-half, half + 1):
+        sinc = 1.0 if n == 0 else math.sin(math.pi * n / factor) / (math.pi * n / factor)
+        window = bessel_i0(beta * math.sqrt(1 - (n / (half + 1)) ** 2)) / bessel_i0(beta)
+        h.append(sinc * window / factor)
+    s = sum(h)
+    return [v / s for v in h]
+
+
+# The coefficients of decimate() in ayumi.cpp (x[0] is the newest sample).
+def original_taps(path):
+    source = open(path).read()
+    body = source[source.index("static double decimate(double* x) {"):]
+    body = body[:body.index("memcpy")]
+    h = [0.0] * FIR_SIZE
+    for c, a, b in re.findall(r"([-0-9.e]+) \* \(x\[(\d+)\] \+ x\[(\d+)\]\)", body):
+        h[int(a)] = h[int(b)] = float(c)
+    h[CENTER] = float(re.search(r"([-0-9.e]+) \* x\[%d\];" % CENTER, body).group(1))
+    return h
+
+
+def fft(a, inverse=False):
+    n = len(a)
+    a = list(a)
+    j = 0
+    for i in range(1, n):
+        bit = n >> 1
+        while j & bit:
+            j ^= bit
+            bit >>= 1
+        j |= bit
+        if i < j:
+            a[i], a[j] = a[j], a[i]
+    size = 2
+    while size <= n:
+        w = cmath.exp((2j if inverse else -2j) * math.pi / size)
+        for start in range(0, n, size):
+            wk = 1
+            for k in range(size // 2):
+                u = a[start + k]
+                v = a[start + k + size // 2] * wk
+                a[start + k] = u + v
+                a[start + k + size // 2] = u - v
+                wk *= w
+        size <<= 1
+    return [v / n for v in a] if inverse else a
+
+
+# Minimum-phase filter with the magnitude response of `h` (homomorphic method: the real cepstrum of the log
+# magnitude, folded onto the causal side). The stopband zeros are floored at -160dB.
+def minimum_phase(h, n=1 << 14):
+    spectrum = fft(list(h) + [0.0] * (n - len(h)))
+    cepstrum = fft([math.log(max(abs(v), 1e-8)) for v in spectrum], True)
+    folded = [0j] * n
+    folded[0] = cepstrum[0]
+    folded[n // 2] = cepstrum[n // 2]
+    for i in range(1, n // 2):
+        folded[i] = 2 * cepstrum[i]
+    taps = [v.real for v in fft([cmath.exp(v) for v in fft(folded)], True)][:len(h)]
+    s = sum(taps)
+    return [v / s for v in taps]
+
+
+def linear_function(name, half, beta, factor):
+    h = kaiser_lowpass(half, beta, factor)
+    center = FIR_FRAMES * factor // 2
+    lines = []
+    for n in range(half, 0, -1):
+        if n % factor == 0:
+            continue  # zeros of the sinc
+        lines.append("%s * (x[%d] + x[%d])" % (repr(h[half + n]), center - n, center + n))
+    if factor == DECIMATE_FACTOR:
+        shift = "memcpy(&x[FIR_SIZE - DECIMATE_FACTOR], x, DECIMATE_FACTOR * sizeof(double));"
+    else:
+        shift = "memcpy(&x[%d], x, %d * sizeof(double));" % (FIR_FRAMES * factor - factor, factor)
+    return ("static double %s(double* x) {\n  double y = " % name + " +\n    ".join(lines)
+            + " +\n    %s * x[%d];\n" % (repr(h[half]), center)
+            + "  %s\n  return y;\n}\n" % shift)
+
+
+def table(name, taps):
+    rows = []
+    for i in range(0, len(taps), 4):
+        rows.append("  " + ", ".join(repr(v) for v in taps[i:i + 4]))
+    return "static const double %s[%d] = {\n%s\n};\n" % (name, len(taps), ",\n".join(rows))
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(__file__), "..", "..", "src", "ayumi.cpp")
+    tables = []
+    for factor in (8, 4, 2):
+        prefix = "" if factor == DECIMATE_FACTOR else "%dx_" % factor
+        for half, beta in TIERS:
+            if half is None and factor == DECIMATE_FACTOR:
+                tables.append(table("min_phase_192", minimum_phase(original_taps(path))))
+                continue
+            # the same span in output frames as at DECIMATE_FACTOR
+            half = ((half if half is not None else CENTER - 1) + 1) * factor // DECIMATE_FACTOR - 1
+            name = "%s%d" % (prefix, 2 * half + 1)
+            print(linear_function("decimate_" + name, half, beta, factor))
+            tables.append(table("min_phase_" + name, minimum_phase(kaiser_lowpass(half, beta, factor))))
+    print("\n".join(tables), end="")
+
+
+if __name__ == "__main__":
+    main()
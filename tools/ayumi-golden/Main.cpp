@@ -0,0 +1,677 @@
+/*
+  ==============================================================================
+
+    ayumi-golden: golden-output regression harness for the ayumi core,
+    independent of JUCE.
+
+    A corpus of canonical register scenarios is rendered through the
+    reference path (ayumi_process() + ayumi_remove_dc()). `record` stores
+    the checksums and reference WAVs; `check` verifies the reference against
+    stored checksums, and compares every other engine mode with it: bit-exact
+    where the mode promises so, against SNR and log-spectral distance
+    thresholds otherwise.
+
+  ==============================================================================
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ayumi.h"
+
+struct Scenario {
+    const char* name;
+    int isYm;
+    double clockRate;
+    int sampleRate;
+    int frames;
+    // applies the register changes of `frame` (a function of the frame only, so that any frame can be replayed).
+    // `stems` are the ones the mode renders (or NULL), for changes that carry them over.
+    void (*update)(struct ayumi* ay, struct ayumi_stem* stems, int frame);
+};
+
+static void setupChannels(struct ayumi* ay, int tOff, int nOff, int eOn)
+{
+    for (int i = 0; i < TONE_CHANNELS; i++) {
+        ayumi_set_pan(ay, i, 0.2 + 0.3 * i, 0);
+        ayumi_set_mixer(ay, i, tOff, nOff, eOn);
+        ayumi_set_volume(ay, i, 14 - i);
+    }
+}
+
+static const Scenario scenarios[] = {
+    {"tone-chord", 0, 1773400, 44100, 44100, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0) {
+            setupChannels(ay, 0, 1, 0);
+            for (int i = 0; i < TONE_CHANNELS; i++)
+                ayumi_set_tone(ay, i, 252 - 50 * i);
+        }
+    }},
+    {"tone-sweep", 1, 2000000, 48000, 48000, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0)
+            setupChannels(ay, 0, 1, 0);
+        if (frame % 480 == 0)
+            for (int i = 0; i < TONE_CHANNELS; i++)
+                ayumi_set_tone(ay, i, 40 + (frame / 480 * (7 + i * 5)) % 900);
+    }},
+    {"noise", 0, 1773400, 44100, 44100, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0)
+            setupChannels(ay, 1, 0, 0);
+        if (frame % 2205 == 0)
+            ayumi_set_noise(ay, 1 + frame / 2205 % 31);
+    }},
+    {"tone+noise", 1, 2000000, 44100, 44100, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0) {
+            setupChannels(ay, 0, 0, 0);
+            ayumi_set_noise(ay, 5);
+            for (int i = 0; i < TONE_CHANNELS; i++)
+                ayumi_set_tone(ay, i, 300 + 41 * i);
+        }
+    }},
+    {"envelope-shapes", 1, 2000000, 44100, 70560, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0) {
+            setupChannels(ay, 0, 1, 1);
+            for (int i = 0; i < TONE_CHANNELS; i++)
+                ayumi_set_tone(ay, i, 500 + 100 * i);
+            ayumi_set_envelope(ay, 0x180);
+        }
+        if (frame % 4410 == 0)
+            ayumi_set_envelope_shape(ay, frame / 4410 % 16);
+    }},
+    {"buzzer", 0, 1773400, 48000, 48000, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0) {
+            setupChannels(ay, 1, 1, 1);
+            ayumi_set_mixer(ay, 0, 0, 1, 1);
+            ayumi_set_tone(ay, 0, 224);
+            ayumi_set_envelope_shape(ay, 10);
+        }
+        if (frame % 6000 == 0)
+            ayumi_set_envelope(ay, 14 + frame / 6000 * 3);
+    }},
+    {"volume-digi", 0, 1773400, 44100, 44100, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0)
+            setupChannels(ay, 1, 1, 0);
+        // 4-bit sample playback through the volume registers, one write per frame
+        ayumi_set_volume(ay, 0, (int) (7.5 + 7.5 * sin(frame * 0.0713) * sin(frame * 0.00091)));
+    }},
+    {"high-clock", 1, 4000000, 96000, 96000, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0) {
+            setupChannels(ay, 0, 1, 0);
+            ayumi_set_mixer(ay, 2, 1, 0, 0);
+            ayumi_set_noise(ay, 3);
+        }
+        if (frame % 1200 == 0)
+            for (int i = 0; i < 2; i++)
+                ayumi_set_tone(ay, i, 100 + (frame / 1200 * 37 + i * 211) % 1500);
+    }},
+    {"low-rate", 0, 1000000, 22050, 22050, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0) {
+            setupChannels(ay, 0, 1, 0);
+            ayumi_set_mixer(ay, 1, 0, 1, 1);
+            ayumi_set_envelope(ay, 0x300);
+            ayumi_set_envelope_shape(ay, 14);
+        }
+        if (frame % 2756 == 0)
+            for (int i = 0; i < TONE_CHANNELS; i++)
+                ayumi_set_tone(ay, i, 80 + (frame / 2756 * 13 + i * 90) % 700);
+    }},
+    // 4x and 2x oversampling
+    {"hi-res", 0, 1773400, 96000, 96000, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0) {
+            setupChannels(ay, 0, 1, 0);
+            ayumi_set_mixer(ay, 2, 0, 0, 0);
+            ayumi_set_noise(ay, 9);
+        }
+        if (frame % 960 == 0)
+            for (int i = 0; i < TONE_CHANNELS; i++)
+                ayumi_set_tone(ay, i, 30 + (frame / 960 * (11 + i * 3)) % 1200);
+    }},
+    {"high-rate", 1, 2000000, 192000, 192000, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0) {
+            setupChannels(ay, 0, 1, 1);
+            ayumi_set_mixer(ay, 1, 0, 1, 0);
+            ayumi_set_envelope(ay, 0x40);
+        }
+        if (frame % 9600 == 0) {
+            ayumi_set_envelope_shape(ay, 8 + frame / 9600 % 8);
+            for (int i = 0; i < TONE_CHANNELS; i++)
+                ayumi_set_tone(ay, i, 60 + (frame / 9600 * 97 + i * 150) % 1000);
+        }
+    }},
+    // clock changes that switch the oversampling between 4x and 2x while tones are held
+    {"clock-switch", 1, 2000000, 96000, 96000, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0) {
+            setupChannels(ay, 0, 1, 0);
+            for (int i = 0; i < TONE_CHANNELS; i++)
+                ayumi_set_tone(ay, i, 180 + 70 * i);
+        }
+        if (frame % 24000 == 12000)
+            ayumi_reconfigure(ay, stems, 1, frame / 24000 % 2 == 0 ? 1000000 : 2000000, 96000);
+    }},
+    // steady chords over 15 tone periods, more than the tone cache keeps tables for, so that they are evicted
+    // and rebuilt as the chords come back
+    {"tone-eviction", 0, 1773400, 44100, 44100, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0)
+            setupChannels(ay, 0, 1, 0);
+        if (frame % 2205 == 0)
+            for (int i = 0; i < TONE_CHANNELS; i++)
+                ayumi_set_tone(ay, i, 120 + 37 * (frame / 2205 % 5) + 260 * i);
+    }},
+    // steady tones while the volumes, the mixer and the panning change
+    {"tone-mixer", 1, 2000000, 48000, 48000, [](struct ayumi* ay, struct ayumi_stem* stems, int frame) {
+        if (frame == 0) {
+            setupChannels(ay, 0, 1, 0);
+            for (int i = 0; i < TONE_CHANNELS; i++)
+                ayumi_set_tone(ay, i, 200 + 90 * i);
+        }
+        if (frame % 1600 == 800)
+            ayumi_set_volume(ay, frame / 1600 % 3, frame / 1600 * 5 % 16);
+        if (frame % 6000 == 3000)
+            ayumi_set_mixer(ay, 1, frame / 6000 % 2 == 0, 1, 0);
+        if (frame % 9600 == 4000)
+            ayumi_set_pan(ay, 2, frame / 9600 % 2 == 0 ? 0.1 : 0.8, 0);
+    }},
+};
+
+// Interleaved stereo output of a mode, and the frames it does not promise to reproduce.
+struct Rendered {
+    std::vector<double> samples;
+    std::vector<std::pair<int, int>> skipped; // [from, to) frame ranges
+    // frames the mode rendered its own way, for modes that fall back to the reference path (-1 if they never do)
+    int engagedFrames{-1};
+
+    bool overlapsSkipped(int from, int to) const
+    {
+        for (auto& range : skipped)
+            if (to > range.first && from < range.second)
+                return true;
+        return false;
+    }
+};
+
+static void configure(struct ayumi* ay, const Scenario& scenario)
+{
+    memset(ay, 0, sizeof(struct ayumi));
+    ayumi_configure(ay, scenario.isYm, scenario.clockRate, scenario.sampleRate);
+}
+
+static void renderReference(const Scenario& scenario, Rendered& out)
+{
+    static struct ayumi ay;
+    configure(&ay, scenario);
+    for (int frame = 0; frame < scenario.frames; frame++) {
+        scenario.update(&ay, nullptr, frame);
+        ayumi_process(&ay);
+        ayumi_remove_dc(&ay);
+        out.samples.push_back(ay.left);
+        out.samples.push_back(ay.right);
+    }
+}
+
+// The mono path renders (left + right) / 2 of the reference, up to rounding.
+static void renderMono(const Scenario& scenario, Rendered& out)
+{
+    static struct ayumi ay;
+    configure(&ay, scenario);
+    for (int frame = 0; frame < scenario.frames; frame++) {
+        scenario.update(&ay, nullptr, frame);
+        ayumi_process_mono(&ay);
+        ayumi_remove_dc_mono(&ay);
+        out.samples.push_back(ay.left);
+        out.samples.push_back(ay.right);
+    }
+}
+
+// The per-channel stems add up to the reference output, up to rounding.
+static void renderStems(const Scenario& scenario, Rendered& out)
+{
+    static struct ayumi ay;
+    static struct ayumi_stem stems[TONE_CHANNELS];
+    configure(&ay, scenario);
+    memset(stems, 0, sizeof(stems));
+    for (int frame = 0; frame < scenario.frames; frame++) {
+        scenario.update(&ay, stems, frame);
+        ayumi_process_stems(&ay, stems);
+        ayumi_remove_dc_stems(&ay, stems);
+        out.samples.push_back(ay.left);
+        out.samples.push_back(ay.right);
+    }
+}
+
+// Renders up to the middle, restores a snapshot taken at a third, and renders the rest from there.
+static void renderSnapshot(const Scenario& scenario, Rendered& out)
+{
+    static struct ayumi ay;
+    static struct ayumi_snapshot snapshot;
+    configure(&ay, scenario);
+    int saveAt = scenario.frames / 3;
+    for (int frame = 0; frame < scenario.frames / 2; frame++) {
+        if (frame == saveAt)
+            ayumi_save(&ay, &snapshot);
+        scenario.update(&ay, nullptr, frame);
+        ayumi_process(&ay);
+        ayumi_remove_dc(&ay);
+        if (frame < saveAt) {
+            out.samples.push_back(ay.left);
+            out.samples.push_back(ay.right);
+        }
+    }
+    ayumi_restore(&ay, &snapshot);
+    for (int frame = saveAt; frame < scenario.frames; frame++) {
+        scenario.update(&ay, nullptr, frame);
+        ayumi_process(&ay);
+        ayumi_remove_dc(&ay);
+        out.samples.push_back(ay.left);
+        out.samples.push_back(ay.right);
+    }
+}
+
+// Fast-forwards the second quarter. The output is identical again once the pre-roll has refilled the filters
+// and the DC filter has resynced on a full window of fresh input.
+static void renderFastForward(const Scenario& scenario, Rendered& out)
+{
+    static struct ayumi ay;
+    configure(&ay, scenario);
+    int from = scenario.frames / 4;
+    int to = scenario.frames / 2;
+    int exactFrom = (to + ayumi_preroll_frames(&ay) + DC_FILTER_SIZE * 2 - 1) / DC_FILTER_SIZE * DC_FILTER_SIZE;
+    for (int frame = 0; frame < scenario.frames; frame++) {
+        scenario.update(&ay, nullptr, frame);
+        if (frame >= from && frame < to) {
+            ayumi_fast_forward(&ay, 1);
+            ay.left = ay.right = 0;
+        } else {
+            ayumi_process(&ay);
+            ayumi_remove_dc(&ay);
+        }
+        out.samples.push_back(ay.left);
+        out.samples.push_back(ay.right);
+    }
+    out.skipped.push_back({from, std::min(exactFrom, scenario.frames)});
+}
+
+static void renderToneCache(const Scenario& scenario, Rendered& out)
+{
+    static struct ayumi ay;
+    static struct ayumi_tone_cache cache;
+    configure(&ay, scenario);
+    ayumi_tone_cache_init(&cache);
+    out.engagedFrames = 0;
+    for (int frame = 0; frame < scenario.frames; frame++) {
+        auto factor = ay.decimate_factor;
+        scenario.update(&ay, nullptr, frame);
+        // when the oversampling factor changes, the reference refills the FIR history with the current level, while
+        // the cache rebuilds it from the chip, which lags behind; they differ for as long as the FIR spans.
+        if (ay.decimate_factor != factor)
+            out.skipped.push_back({frame, frame + FIR_FRAMES});
+        ayumi_process_cached(&ay, &cache);
+        ayumi_remove_dc(&ay);
+        if (cache.active)
+            out.engagedFrames++;
+        out.samples.push_back(ay.left);
+        out.samples.push_back(ay.right);
+    }
+}
+
+static void renderQuality(const Scenario& scenario, Rendered& out, int quality)
+{
+    static struct ayumi ay;
+    configure(&ay, scenario);
+    ayumi_set_quality(&ay, nullptr, quality);
+    for (int frame = 0; frame < scenario.frames; frame++) {
+        scenario.update(&ay, nullptr, frame);
+        ayumi_process(&ay);
+        ayumi_remove_dc(&ay);
+        out.samples.push_back(ay.left);
+        out.samples.push_back(ay.right);
+    }
+}
+
+static void renderQualityReduced(const Scenario& scenario, Rendered& out)
+{
+    renderQuality(scenario, out, AYUMI_QUALITY_REDUCED);
+}
+
+static void renderQualityLow(const Scenario& scenario, Rendered& out)
+{
+    renderQuality(scenario, out, AYUMI_QUALITY_LOW);
+}
+
+// Steps down through the tiers and back up, as the governor in the plugin does.
+static void renderQualitySwitch(const Scenario& scenario, Rendered& out)
+{
+    static struct ayumi ay;
+    static const int tiers[] = {AYUMI_QUALITY_FULL, AYUMI_QUALITY_REDUCED, AYUMI_QUALITY_LOW, AYUMI_QUALITY_REDUCED,
+                                AYUMI_QUALITY_FULL};
+    configure(&ay, scenario);
+    for (int frame = 0; frame < scenario.frames; frame++) {
+        if (frame % (scenario.frames / 5) == 0)
+            ayumi_set_quality(&ay, nullptr, tiers[std::min(4, frame / (scenario.frames / 5))]);
+        scenario.update(&ay, nullptr, frame);
+        ayumi_process(&ay);
+        ayumi_remove_dc(&ay);
+        out.samples.push_back(ay.left);
+        out.samples.push_back(ay.right);
+    }
+}
+
+// An engine mode and what it promises with regard to the reference. New modes are added here.
+// Minimum-phase filters, delayed by whole frames to line up with the reference at low frequencies.
+static void renderLowLatency(const Scenario& scenario, Rendered& out)
+{
+    static struct ayumi ay;
+    configure(&ay, scenario);
+    auto fullLatency = ayumi_latency(&ay);
+    ayumi_set_low_latency(&ay, 1);
+    auto shift = (int) std::lround(fullLatency - ayumi_latency(&ay));
+    out.samples.assign((size_t) shift * 2, 0.0);
+    for (int frame = 0; frame < scenario.frames - shift; frame++) {
+        scenario.update(&ay, nullptr, frame);
+        ayumi_process(&ay);
+        ayumi_remove_dc(&ay);
+        out.samples.push_back(ay.left);
+        out.samples.push_back(ay.right);
+    }
+}
+
+// Always 8x oversampling, as before the factor was picked from the rates.
+static void renderOversampling8(const Scenario& scenario, Rendered& out)
+{
+    static struct ayumi ay;
+    configure(&ay, scenario);
+    ayumi_set_decimate_factor(&ay, nullptr, DECIMATE_FACTOR);
+    for (int frame = 0; frame < scenario.frames; frame++) {
+        scenario.update(&ay, nullptr, frame);
+        ayumi_process(&ay);
+        ayumi_remove_dc(&ay);
+        out.samples.push_back(ay.left);
+        out.samples.push_back(ay.right);
+    }
+}
+
+struct Mode {
+    const char* name;
+    void (*render)(const Scenario& scenario, Rendered& out);
+    bool mono; // compared with the downmixed reference
+    bool exact;
+    double minSnr; // dB, when not exact
+    double maxSpectralDistance; // dB, when not exact
+};
+
+static const Mode modes[] = {
+    {"mono", renderMono, true, false, 250, 0.01},
+    {"stems", renderStems, false, false, 250, 0.01},
+    {"snapshot", renderSnapshot, false, true, 0, 0},
+    {"fast-forward", renderFastForward, false, true, 0, 0},
+    {"tone-cache", renderToneCache, false, false, 35, 3},
+    {"quality-1", renderQualityReduced, false, false, 25, 2.5},
+    {"quality-2", renderQualityLow, false, false, 12, 6},
+    {"quality-switch", renderQualitySwitch, false, false, 18, 4},
+    {"low-latency", renderLowLatency, false, false, 6, 2},
+    {"oversampling-8", renderOversampling8, false, false, 60, 0.1},
+};
+
+// FNV-1a over the bit patterns of the samples.
+static uint64_t checksum(const std::vector<double>& samples)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (auto sample : samples) {
+        uint64_t bits;
+        memcpy(&bits, &sample, sizeof(bits));
+        for (int i = 0; i < 8; i++) {
+            hash ^= (bits >> (i * 8)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+static void writeLittleEndian(std::ofstream& file, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        file.put((char) ((value >> (i * 8)) & 0xff));
+}
+
+// 32-bit float stereo WAV.
+static bool writeWav(const std::string& path, const std::vector<double>& samples, int sampleRate)
+{
+    std::ofstream file{path, std::ios::binary};
+    if (!file)
+        return false;
+    auto dataSize = (uint32_t) (samples.size() * 4);
+    file.write("RIFF", 4);
+    writeLittleEndian(file, 36 + dataSize, 4);
+    file.write("WAVEfmt ", 8);
+    writeLittleEndian(file, 16, 4);
+    writeLittleEndian(file, 3, 2); // IEEE float
+    writeLittleEndian(file, 2, 2);
+    writeLittleEndian(file, (uint32_t) sampleRate, 4);
+    writeLittleEndian(file, (uint32_t) sampleRate * 8, 4);
+    writeLittleEndian(file, 8, 2);
+    writeLittleEndian(file, 32, 2);
+    file.write("data", 4);
+    writeLittleEndian(file, dataSize, 4);
+    for (auto sample : samples) {
+        auto f = (float) sample;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        writeLittleEndian(file, bits, 4);
+    }
+    return (bool) file;
+}
+
+static const double pi = 3.14159265358979323846;
+
+static void fft(std::vector<std::complex<double>>& a)
+{
+    auto n = a.size();
+    for (size_t i = 1, j = 0; i < n; i++) {
+        auto bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(a[i], a[j]);
+    }
+    for (size_t length = 2; length <= n; length <<= 1) {
+        auto w = std::polar(1.0, -2 * pi / (double) length);
+        for (size_t i = 0; i < n; i += length) {
+            std::complex<double> wk = 1;
+            for (size_t k = 0; k < length / 2; k++) {
+                auto u = a[i + k];
+                auto v = a[i + k + length / 2] * wk;
+                a[i + k] = u + v;
+                a[i + k + length / 2] = u - v;
+                wk *= w;
+            }
+        }
+    }
+}
+
+struct Comparison {
+    size_t mismatches{0};
+    double snr{INFINITY};
+    double spectralDistance{0};
+};
+
+enum { SPECTRUM_SIZE = 1024 };
+
+// Log-spectral distance (RMS over the bins of the dB difference, averaged over Hann windows) of one channel.
+static double spectralDistance(const std::vector<double>& reference, const std::vector<double>& samples, int channel,
+                               const Rendered& rendered)
+{
+    std::vector<std::complex<double>> a(SPECTRUM_SIZE), b(SPECTRUM_SIZE);
+    double total = 0;
+    int windows = 0;
+    int frames = (int) reference.size() / 2;
+    for (int start = 0; start + SPECTRUM_SIZE <= frames; start += SPECTRUM_SIZE) {
+        if (rendered.overlapsSkipped(start, start + SPECTRUM_SIZE))
+            continue;
+        for (int i = 0; i < SPECTRUM_SIZE; i++) {
+            double window = 0.5 - 0.5 * cos(2 * pi * i / SPECTRUM_SIZE);
+            a[i] = reference[(start + i) * 2 + channel] * window;
+            b[i] = samples[(start + i) * 2 + channel] * window;
+        }
+        fft(a);
+        fft(b);
+        // bins more than 60dB below the strongest one are treated as silence
+        double peak = 0;
+        for (int k = 1; k < SPECTRUM_SIZE / 2; k++)
+            peak = std::max(peak, std::norm(a[k]));
+        double floor = std::max(peak * 1e-6, 1e-20);
+        double sum = 0;
+        for (int k = 1; k < SPECTRUM_SIZE / 2; k++) {
+            double d = 10 * log10((std::norm(a[k]) + floor) / (std::norm(b[k]) + floor));
+            sum += d * d;
+        }
+        total += sqrt(sum / (SPECTRUM_SIZE / 2 - 1));
+        windows++;
+    }
+    return windows > 0 ? total / windows : 0;
+}
+
+static Comparison compare(const std::vector<double>& reference, const Rendered& rendered)
+{
+    Comparison c;
+    double signal = 0;
+    double noise = 0;
+    for (size_t i = 0; i < reference.size(); i++) {
+        auto frame = (int) (i / 2);
+        if (rendered.overlapsSkipped(frame, frame + 1))
+            continue;
+        auto d = rendered.samples[i] - reference[i];
+        if (d != 0 || std::signbit(rendered.samples[i]) != std::signbit(reference[i]))
+            c.mismatches++;
+        signal += reference[i] * reference[i];
+        noise += d * d;
+    }
+    if (noise > 0)
+        c.snr = 10 * log10(signal / noise);
+    c.spectralDistance = std::max(spectralDistance(reference, rendered.samples, 0, rendered),
+                                  spectralDistance(reference, rendered.samples, 1, rendered));
+    return c;
+}
+
+static std::map<std::string, uint64_t> readChecksums(const std::string& path)
+{
+    std::map<std::string, uint64_t> checksums;
+    std::ifstream file{path};
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields{line};
+        std::string name;
+        std::string hash;
+        if (fields >> name >> hash)
+            checksums[name] = std::stoull(hash, nullptr, 16);
+    }
+    return checksums;
+}
+
+static int record(const std::string& directory)
+{
+    auto path = directory + "/checksums.txt";
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        fprintf(stderr, "Cannot write %s\n", path.c_str());
+        return 1;
+    }
+    fprintf(file, "# ayumi-golden reference checksums (FNV-1a of the 64-bit output samples)\n");
+    for (auto& scenario : scenarios) {
+        Rendered reference;
+        renderReference(scenario, reference);
+        fprintf(file, "%s %016llx\n", scenario.name, (unsigned long long) checksum(reference.samples));
+        auto wav = directory + "/" + scenario.name + ".wav";
+        if (!writeWav(wav, reference.samples, scenario.sampleRate)) {
+            fprintf(stderr, "Cannot write %s\n", wav.c_str());
+            fclose(file);
+            return 1;
+        }
+        printf("recorded %s\n", scenario.name);
+    }
+    fclose(file);
+    return 0;
+}
+
+static int check(const std::string& checksumPath)
+{
+    std::map<std::string, uint64_t> checksums;
+    if (!checksumPath.empty()) {
+        checksums = readChecksums(checksumPath);
+        if (checksums.empty()) {
+            fprintf(stderr, "No checksums in %s\n", checksumPath.c_str());
+            return 1;
+        }
+    }
+    int failures = 0;
+    std::map<std::string, int> engaged; // scenarios in which each mode rendered any frame its own way
+    for (auto& scenario : scenarios) {
+        Rendered reference;
+        renderReference(scenario, reference);
+        auto downmixed = reference.samples;
+        for (size_t i = 0; i < downmixed.size(); i += 2)
+            downmixed[i] = downmixed[i + 1] = (downmixed[i] + downmixed[i + 1]) * 0.5;
+        if (!checksumPath.empty()) {
+            auto expected = checksums.find(scenario.name);
+            bool ok = expected != checksums.end() && expected->second == checksum(reference.samples);
+            printf("%s %-16s %-13s %s\n", ok ? "PASS" : "FAIL", scenario.name, "reference",
+                   expected == checksums.end() ? "no checksum" : "checksum");
+            failures += ok ? 0 : 1;
+        }
+        for (auto& mode : modes) {
+            Rendered rendered;
+            mode.render(scenario, rendered);
+            // a mode that fell back to the reference path throughout is not tested by the scenario
+            if (rendered.engagedFrames == 0) {
+                printf("SKIP %-16s %-13s never engaged\n", scenario.name, mode.name);
+                continue;
+            }
+            engaged[mode.name]++;
+            auto c = compare(mode.mono ? downmixed : reference.samples, rendered);
+            bool ok = mode.exact ? c.mismatches == 0
+                                 : c.snr >= mode.minSnr && c.spectralDistance <= mode.maxSpectralDistance;
+            if (mode.exact)
+                printf("%s %-16s %-13s bit-exact: %zu mismatched samples\n", ok ? "PASS" : "FAIL", scenario.name,
+                       mode.name, c.mismatches);
+            else
+                printf("%s %-16s %-13s SNR %.1f dB (min %.0f), spectral distance %.4f dB (max %.2f)%s\n",
+                       ok ? "PASS" : "FAIL", scenario.name, mode.name, c.snr, mode.minSnr, c.spectralDistance,
+                       mode.maxSpectralDistance,
+                       rendered.engagedFrames > 0
+                           ? (", engaged in " + std::to_string(rendered.engagedFrames) + " frames").c_str()
+                           : "");
+            failures += ok ? 0 : 1;
+        }
+    }
+    for (auto& mode : modes) {
+        if (engaged[mode.name] == 0) {
+            printf("FAIL %-16s %-13s never engaged in any scenario\n", "(all)", mode.name);
+            failures++;
+        }
+    }
+    printf("%d failure(s)\n", failures);
+    return failures > 0 ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string command = argc > 1 ? argv[1] : "";
+    if (command == "record" && argc == 3)
+        return record(argv[2]);
+    if (command == "check" && argc <= 3)
+        return check(argc == 3 ? argv[2] : "");
+    fprintf(stderr, "Usage: ayumi-golden record DIRECTORY\n"
+                    "       ayumi-golden check [CHECKSUMS]\n"
+                    "record renders the reference scenarios to DIRECTORY (checksums.txt and a WAV per scenario).\n"
+                    "check compares every engine mode with the reference, and the reference with CHECKSUMS.\n");
+    return command == "-h" || command == "--help" ? 0 : 1;
+}
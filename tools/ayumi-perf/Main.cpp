@@ -0,0 +1,239 @@
+/*
+  ==============================================================================
+
+    ayumi-perf: measures AyumiAudioProcessor::processBlock() with scripted
+    MIDI scenarios over a range of buffer sizes, for capacity planning.
+    Results are written as JSON to the standard output.
+
+  ==============================================================================
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <juce_core/juce_core.h>
+#include <juce_events/juce_events.h>
+#include "MultiInstance.h"
+#include "PluginProcessor.h"
+#include "Scenarios.h"
+
+struct Options {
+    double sampleRate{48000};
+    double seconds{10};
+    std::vector<int> blockSizes{16, 32, 64, 128, 256, 512, 1024, 2048};
+    juce::String scenario{}; // empty: all
+};
+
+struct BlockStats {
+    double realtimeFactor;
+    double p50;
+    double p99;
+    double max;
+};
+
+static void printUsage()
+{
+    std::cerr << "Usage: ayumi-perf [options]" << std::endl
+              << "Options:" << std::endl
+              << "  -r, --sample-rate N    sample rate (default: 48000)" << std::endl
+              << "  -d, --duration SECONDS audio length rendered per measurement (default: 10)" << std::endl
+              << "  -b, --block-size N     buffer size to measure, can be repeated (default: 16 to 2048)" << std::endl
+              << "  -s, --scenario NAME    idle, sustained, arpeggio, cc-storm, sysex or soft-envelope (default: all)" << std::endl
+              << "  -i, --instances N      run the multi-instance benchmark with N instances, can be repeated" << std::endl
+              << "                         (default: 1 to 256). Instances play variations of one scenario" << std::endl
+              << "                         (default: arpeggio) at one block size (default: 256), for 2 seconds" << std::endl
+              << "                         unless specified otherwise" << std::endl
+              << "  -t, --threads N        number of rendering threads for the multi-instance benchmark, can be" << std::endl
+              << "                         repeated (default: 1). Each instance count is also rendered through an" << std::endl
+              << "                         AudioProcessorGraph on one thread, reported as a separate \"graph\" row" << std::endl
+              << "  -l, --load N           measure loading a project of N instances instead, can be repeated" << std::endl;
+}
+
+// Percentile of sorted values (nearest rank).
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    auto rank = (size_t) std::ceil(p / 100.0 * (double) sorted.size());
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+// Loads a project of `instances` instances as a host does: each one is created, given the saved state, has the
+// loaded parameter values echoed back as a host syncing its parameter view does, and is prepared. Returns seconds.
+static double measureProjectLoad(const Options& options, int instances, const juce::MemoryBlock& state)
+{
+    auto blockSize = options.blockSizes[0];
+    std::vector<std::unique_ptr<AyumiAudioProcessor>> processors;
+    processors.reserve((size_t) instances);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < instances; i++) {
+        std::unique_ptr<AyumiAudioProcessor> processor{new AyumiAudioProcessor()};
+        processor->setStateInformation(state.getData(), (int) state.getSize());
+        for (auto parameter : processor->getParameters())
+            parameter->setValueNotifyingHost(parameter->getValue());
+        processor->setRateAndBufferSizeDetails(options.sampleRate, blockSize);
+        processor->prepareToPlay(options.sampleRate, blockSize);
+        processors.push_back(std::move(processor));
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+static BlockStats measure(const Options& options, const Scenario& scenario, int blockSize, juce::int64 length)
+{
+    AyumiAudioProcessor processor;
+    processor.setNonRealtime(false);
+    processor.setRateAndBufferSizeDetails(options.sampleRate, blockSize);
+    processor.prepareToPlay(options.sampleRate, blockSize);
+
+    juce::AudioBuffer<float> buffer{processor.getTotalNumOutputChannels(), blockSize};
+    juce::MidiBuffer midi;
+    midi.ensureSize(4096);
+    std::vector<double> times;
+    times.reserve((size_t) (length / blockSize + 1));
+
+    int nextEvent = 0;
+    double total = 0;
+    for (juce::int64 position = 0; position < length; position += blockSize) {
+        fillMidiBuffer(scenario.sequence, midi, nextEvent, position, blockSize);
+        buffer.clear();
+        auto start = std::chrono::steady_clock::now();
+        processor.processBlock(buffer, midi);
+        auto end = std::chrono::steady_clock::now();
+        auto seconds = std::chrono::duration<double>(end - start).count();
+        times.push_back(seconds);
+        total += seconds;
+    }
+    processor.releaseResources();
+
+    std::sort(times.begin(), times.end());
+    return {(double) length / options.sampleRate / total, percentile(times, 50), percentile(times, 99), times.back()};
+}
+
+int main(int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    Options options;
+    MultiInstanceOptions multi;
+    bool blockSizesGiven = false;
+    bool durationGiven = false;
+    bool multiInstance = false;
+    bool threadsGiven = false;
+    std::vector<int> loads;
+    for (int i = 1; i < argc; i++) {
+        juce::String arg{argv[i]};
+        bool hasValue = i + 1 < argc;
+        if ((arg == "-r" || arg == "--sample-rate") && hasValue)
+            options.sampleRate = juce::String(argv[++i]).getDoubleValue();
+        else if ((arg == "-d" || arg == "--duration") && hasValue) {
+            options.seconds = juce::String(argv[++i]).getDoubleValue();
+            durationGiven = true;
+        } else if ((arg == "-b" || arg == "--block-size") && hasValue) {
+            if (!blockSizesGiven)
+                options.blockSizes.clear();
+            blockSizesGiven = true;
+            options.blockSizes.push_back(juce::String(argv[++i]).getIntValue());
+        } else if ((arg == "-s" || arg == "--scenario") && hasValue)
+            options.scenario = argv[++i];
+        else if ((arg == "-i" || arg == "--instances") && hasValue) {
+            if (!multiInstance)
+                multi.instances.clear();
+            multiInstance = true;
+            multi.instances.push_back(std::max(1, juce::String(argv[++i]).getIntValue()));
+        } else if ((arg == "-t" || arg == "--threads") && hasValue) {
+            if (!threadsGiven)
+                multi.threads.clear();
+            threadsGiven = true;
+            multiInstance = true;
+            multi.threads.push_back(std::max(1, juce::String(argv[++i]).getIntValue()));
+        } else if ((arg == "-l" || arg == "--load") && hasValue)
+            loads.push_back(std::max(1, juce::String(argv[++i]).getIntValue()));
+        else if (arg == "-h" || arg == "--help") {
+            printUsage();
+            return 0;
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    if (options.sampleRate <= 0 || options.seconds <= 0
+        || std::any_of(options.blockSizes.begin(), options.blockSizes.end(), [](int b) { return b <= 0; })) {
+        printUsage();
+        return 1;
+    }
+
+    if (!loads.empty()) {
+        // a saved state that differs from the defaults in every group of parameters.
+        juce::MemoryBlock state;
+        {
+            AyumiAudioProcessor source;
+            auto parameters = source.getParameters();
+            for (int i = 0; i < parameters.size(); i++)
+                parameters[i]->setValueNotifyingHost(0.25f + 0.5f * (float) (i % 3) / 2);
+            source.getStateInformation(state);
+        }
+        std::cout << "{" << std::endl
+                  << "  \"benchmark\": \"ayumi-project-load\"," << std::endl
+                  << "  \"version\": 1," << std::endl
+                  << "  \"sample_rate\": " << options.sampleRate << "," << std::endl
+                  << "  \"results\": [";
+        for (size_t i = 0; i < loads.size(); i++) {
+            auto seconds = measureProjectLoad(options, loads[i], state);
+            std::cout << (i > 0 ? "," : "") << std::endl
+                      << "    {\"instances\": " << loads[i] << ", \"total_ms\": " << seconds * 1e3
+                      << ", \"per_instance_us\": " << seconds / loads[i] * 1e6 << "}";
+        }
+        std::cout << std::endl << "  ]" << std::endl << "}" << std::endl;
+        return 0;
+    }
+
+    auto length = (juce::int64) (options.seconds * options.sampleRate);
+    auto scenarios = createScenarios(options.sampleRate, length);
+
+    if (multiInstance) {
+        multi.sampleRate = options.sampleRate;
+        if (blockSizesGiven)
+            multi.blockSize = options.blockSizes[0];
+        if (durationGiven)
+            multi.seconds = options.seconds;
+        auto name = options.scenario.isNotEmpty() ? options.scenario : juce::String{"arpeggio"};
+        auto scenario = std::find_if(scenarios.begin(), scenarios.end(), [&](const Scenario& s) { return name == s.name; });
+        if (scenario == scenarios.end()) {
+            printUsage();
+            return 1;
+        }
+        // the scenarios have to be long enough for the multi-instance duration.
+        auto multiScenarios = createScenarios(multi.sampleRate, (juce::int64) (multi.seconds * multi.sampleRate));
+        runMultiInstanceBenchmark(multi, multiScenarios[(size_t) (scenario - scenarios.begin())], std::cout);
+        return 0;
+    }
+
+    std::cout << "{" << std::endl
+              << "  \"benchmark\": \"ayumi-processor\"," << std::endl
+              << "  \"version\": 1," << std::endl
+              << "  \"sample_rate\": " << options.sampleRate << "," << std::endl
+              << "  \"seconds\": " << options.seconds << "," << std::endl
+              << "  \"results\": [";
+    bool first = true;
+    for (auto& scenario : scenarios) {
+        if (options.scenario.isNotEmpty() && options.scenario != scenario.name)
+            continue;
+        for (auto blockSize : options.blockSizes) {
+            auto stats = measure(options, scenario, blockSize, length);
+            // how many instances fit in one buffer period, judging from the 99th percentile.
+            auto period = blockSize / options.sampleRate;
+            std::cout << (first ? "" : ",") << std::endl
+                      << "    {\"scenario\": \"" << scenario.name << "\", \"block_size\": " << blockSize
+                      << ", \"realtime_factor\": " << stats.realtimeFactor
+                      << ", \"p50_us\": " << stats.p50 * 1e6 << ", \"p99_us\": " << stats.p99 * 1e6
+                      << ", \"max_us\": " << stats.max * 1e6
+                      << ", \"instances_per_period_p99\": " << (juce::int64) (period / std::max(stats.p99, 1e-9)) << "}";
+            first = false;
+        }
+    }
+    std::cout << std::endl << "  ]" << std::endl << "}" << std::endl;
+    return 0;
+}
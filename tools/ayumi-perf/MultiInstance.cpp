@@ -0,0 +1,377 @@
+/*
+  ==============================================================================
+
+    Multi-instance scaling benchmark.
+
+  ==============================================================================
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <juce_audio_processors/juce_audio_processors.h>
+#include "MultiInstance.h"
+#include "PluginProcessor.h"
+
+#if JUCE_LINUX
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// An AyumiAudioProcessor playing its own variation of the scenario (shifted in time and transposed),
+// so that the instances do not run in lockstep. Only the stereo main output is passed on.
+class ScenarioPlayer : public juce::AudioProcessor
+{
+public:
+    ScenarioPlayer(const Scenario& scenario, int index)
+        : juce::AudioProcessor(BusesProperties().withOutput("Output", juce::AudioChannelSet::stereo(), true))
+    {
+        for (int i = 0; i < scenario.sequence.getNumEvents(); i++) {
+            auto message = scenario.sequence.getEventPointer(i)->message;
+            if (message.isNoteOnOrOff())
+                message.setNoteNumber(juce::jlimit(0, 127, message.getNoteNumber() + index % 12));
+            message.setTimeStamp(message.getTimeStamp() + (message.getTimeStamp() > 0 ? (index * 37) % 512 : 0));
+            sequence.addEvent(message);
+        }
+        sequence.sort();
+    }
+
+    void prepareToPlay(double sampleRate, int samplesPerBlock) override
+    {
+        processor.setRateAndBufferSizeDetails(sampleRate, samplesPerBlock);
+        processor.prepareToPlay(sampleRate, samplesPerBlock);
+        buffer.setSize(processor.getTotalNumOutputChannels(), samplesPerBlock);
+        midi.ensureSize(4096);
+        position = 0;
+        nextEvent = 0;
+    }
+
+    void releaseResources() override { processor.releaseResources(); }
+
+    void processBlock(juce::AudioBuffer<float>& output, juce::MidiBuffer&) override
+    {
+        auto n = output.getNumSamples();
+        render(n);
+        for (int ch = 0; ch < output.getNumChannels(); ch++)
+            output.copyFrom(ch, 0, buffer, std::min(ch, buffer.getNumChannels() - 1), 0, n);
+    }
+
+    // mixes this instance's last block into `output`.
+    void addTo(juce::AudioBuffer<float>& output, int n) const
+    {
+        for (int ch = 0; ch < output.getNumChannels(); ch++)
+            output.addFrom(ch, 0, buffer, std::min(ch, buffer.getNumChannels() - 1), 0, n);
+    }
+
+    // renders a block into the internal buffer only (for the worker threads).
+    void render(int n)
+    {
+        fillMidiBuffer(sequence, midi, nextEvent, position, n);
+        juce::AudioBuffer<float> block{buffer.getArrayOfWritePointers(), buffer.getNumChannels(), n};
+        block.clear();
+        processor.processBlock(block, midi);
+        position += n;
+    }
+
+    const juce::String getName() const override { return "ScenarioPlayer"; }
+    bool acceptsMidi() const override { return true; }
+    bool producesMidi() const override { return false; }
+    double getTailLengthSeconds() const override { return 0; }
+    juce::AudioProcessorEditor* createEditor() override { return nullptr; }
+    bool hasEditor() const override { return false; }
+    int getNumPrograms() override { return 1; }
+    int getCurrentProgram() override { return 0; }
+    void setCurrentProgram(int) override {}
+    const juce::String getProgramName(int) override { return {}; }
+    void changeProgramName(int, const juce::String&) override {}
+    void getStateInformation(juce::MemoryBlock&) override {}
+    void setStateInformation(const void*, int) override {}
+
+private:
+    AyumiAudioProcessor processor;
+    juce::MidiMessageSequence sequence;
+    juce::AudioBuffer<float> buffer;
+    juce::MidiBuffer midi;
+    juce::int64 position{0};
+    int nextEvent{0};
+};
+
+// Hardware cache references and misses of this process, including the threads started after start().
+// Only where perf_event_open() is available and permitted (Linux, perf_event_paranoid).
+class CacheCounters
+{
+public:
+    CacheCounters()
+    {
+#if JUCE_LINUX
+        references = open(PERF_COUNT_HW_CACHE_REFERENCES);
+        misses = open(PERF_COUNT_HW_CACHE_MISSES);
+#endif
+    }
+
+    ~CacheCounters()
+    {
+#if JUCE_LINUX
+        if (references >= 0)
+            close(references);
+        if (misses >= 0)
+            close(misses);
+#endif
+    }
+
+    bool isAvailable() const { return references >= 0 && misses >= 0; }
+
+    void start()
+    {
+#if JUCE_LINUX
+        for (auto fd : {references, misses}) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    // stops counting and returns {references, misses}.
+    std::pair<juce::uint64, juce::uint64> stop()
+    {
+        juce::uint64 values[2]{};
+#if JUCE_LINUX
+        int fds[2]{references, misses};
+        for (int i = 0; i < 2; i++) {
+            if (fds[i] >= 0) {
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fds[i], &values[i], sizeof(values[i])) != (ssize_t) sizeof(values[i]))
+                    values[i] = 0;
+            }
+        }
+#endif
+        return {values[0], values[1]};
+    }
+
+private:
+    int references{-1};
+    int misses{-1};
+
+#if JUCE_LINUX
+    static int open(juce::uint64 config)
+    {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+};
+
+// Worker threads that render their share of the instances for each block, in lockstep with the caller.
+class BlockWorkers
+{
+public:
+    BlockWorkers(std::vector<std::unique_ptr<ScenarioPlayer>>& players, int numThreads) : players(players)
+    {
+        for (int t = 0; t < numThreads; t++)
+            threads.emplace_back([this, t, numThreads]() { run(t, numThreads); });
+    }
+
+    ~BlockWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            quit = true;
+            generation++;
+        }
+        started.notify_all();
+        for (auto& t : threads)
+            t.join();
+    }
+
+    void render(int n)
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            numSamples = n;
+            remaining = (int) threads.size();
+            generation++;
+        }
+        started.notify_all();
+        std::unique_lock<std::mutex> lock{mutex};
+        finished.wait(lock, [this]() { return remaining == 0; });
+    }
+
+private:
+    std::vector<std::unique_ptr<ScenarioPlayer>>& players;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    juce::uint64 generation{0};
+    int numSamples{0};
+    int remaining{0};
+    bool quit{false};
+
+    void run(int index, int numThreads)
+    {
+        juce::uint64 done = 0;
+        while (true) {
+            int n;
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                started.wait(lock, [&]() { return generation != done; });
+                done = generation;
+                if (quit)
+                    return;
+                n = numSamples;
+            }
+            for (size_t i = (size_t) index; i < players.size(); i += (size_t) numThreads)
+                players[i]->render(n);
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                remaining--;
+            }
+            finished.notify_one();
+        }
+    }
+};
+
+struct Measurement {
+    std::vector<double> times; // per block, in seconds
+    double total{0};
+    bool hasCounters{false};
+    juce::uint64 cacheReferences{0};
+    juce::uint64 cacheMisses{0};
+};
+
+static Measurement measureGraph(const MultiInstanceOptions& options, const Scenario& scenario, int numInstances,
+                                juce::int64 length)
+{
+    juce::AudioProcessorGraph graph;
+    graph.setPlayConfigDetails(0, 2, options.sampleRate, options.blockSize);
+    auto output = graph.addNode(std::make_unique<juce::AudioProcessorGraph::AudioGraphIOProcessor>(
+            juce::AudioProcessorGraph::AudioGraphIOProcessor::audioOutputNode));
+    for (int i = 0; i < numInstances; i++) {
+        auto node = graph.addNode(std::make_unique<ScenarioPlayer>(scenario, i));
+        for (int ch = 0; ch < 2; ch++)
+            graph.addConnection({{node->nodeID, ch}, {output->nodeID, ch}});
+    }
+    graph.prepareToPlay(options.sampleRate, options.blockSize);
+
+    juce::AudioBuffer<float> buffer{2, options.blockSize};
+    juce::MidiBuffer midi;
+    Measurement m;
+    m.times.reserve((size_t) (length / options.blockSize + 1));
+    CacheCounters counters;
+    counters.start();
+    for (juce::int64 position = 0; position < length; position += options.blockSize) {
+        buffer.clear();
+        auto start = std::chrono::steady_clock::now();
+        graph.processBlock(buffer, midi);
+        m.times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        m.total += m.times.back();
+    }
+    std::tie(m.cacheReferences, m.cacheMisses) = counters.stop();
+    m.hasCounters = counters.isAvailable();
+    graph.releaseResources();
+    return m;
+}
+
+static Measurement measureThreads(const MultiInstanceOptions& options, const Scenario& scenario, int numInstances,
+                                  int numThreads, juce::int64 length)
+{
+    std::vector<std::unique_ptr<ScenarioPlayer>> players;
+    for (int i = 0; i < numInstances; i++) {
+        players.emplace_back(new ScenarioPlayer(scenario, i));
+        players.back()->prepareToPlay(options.sampleRate, options.blockSize);
+    }
+
+    juce::AudioBuffer<float> buffer{2, options.blockSize};
+    Measurement m;
+    m.times.reserve((size_t) (length / options.blockSize + 1));
+    // the counters have to be opened before the threads start, so that they are inherited.
+    CacheCounters counters;
+    {
+        BlockWorkers workers{players, numThreads};
+        counters.start();
+        for (juce::int64 position = 0; position < length; position += options.blockSize) {
+            buffer.clear();
+            auto start = std::chrono::steady_clock::now();
+            workers.render(options.blockSize);
+            for (auto& player : players)
+                player->addTo(buffer, options.blockSize);
+            m.times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            m.total += m.times.back();
+        }
+    }
+    // inherited counts are added up when the threads exit.
+    std::tie(m.cacheReferences, m.cacheMisses) = counters.stop();
+    m.hasCounters = counters.isAvailable();
+    for (auto& player : players)
+        player->releaseResources();
+    return m;
+}
+
+static double percentile(std::vector<double>& times, double p)
+{
+    std::sort(times.begin(), times.end());
+    auto rank = (size_t) std::ceil(p / 100.0 * (double) times.size());
+    return times[std::min(times.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+void runMultiInstanceBenchmark(const MultiInstanceOptions& options, const Scenario& scenario, std::ostream& out)
+{
+    auto length = (juce::int64) (options.seconds * options.sampleRate);
+    out << "{" << std::endl
+        << "  \"benchmark\": \"ayumi-processor-instances\"," << std::endl
+        << "  \"version\": 1," << std::endl
+        << "  \"scenario\": \"" << scenario.name << "\"," << std::endl
+        << "  \"sample_rate\": " << options.sampleRate << "," << std::endl
+        << "  \"block_size\": " << options.blockSize << "," << std::endl
+        << "  \"seconds\": " << options.seconds << "," << std::endl
+        << "  \"footprint\": {\"ayumi\": " << sizeof(struct ayumi) << ", \"ayumi_stem\": " << sizeof(struct ayumi_stem)
+        << ", \"ayumi_tone_cache\": " << sizeof(struct ayumi_tone_cache)
+        << ", \"AyumiAudioProcessor\": " << sizeof(AyumiAudioProcessor) << "}," << std::endl
+        << "  \"results\": [";
+    bool first = true;
+    auto writeResult = [&](const char* harness, int numThreads, int numInstances, Measurement& m) {
+        auto numBlocks = (double) m.times.size();
+        auto p50 = percentile(m.times, 50);
+        auto p99 = percentile(m.times, 99);
+        out << (first ? "" : ",") << std::endl
+            << "    {\"harness\": \"" << harness << "\", \"threads\": " << numThreads
+            << ", \"instances\": " << numInstances
+            << ", \"realtime_factor\": " << (double) length / options.sampleRate / m.total
+            << ", \"p50_us\": " << p50 * 1e6 << ", \"p99_us\": " << p99 * 1e6
+            << ", \"max_us\": " << m.times.back() * 1e6
+            << ", \"us_per_instance_block\": " << m.total / numBlocks / numInstances * 1e6;
+        if (m.hasCounters)
+            out << ", \"cache_misses_per_block\": " << (double) m.cacheMisses / numBlocks
+                << ", \"cache_miss_rate\": " << (double) m.cacheMisses / (double) std::max((juce::uint64) 1, m.cacheReferences);
+        out << "}";
+        first = false;
+    };
+    // the graph (one thread, as a host would render) is a reference of its own; the thread counts, including
+    // one, all go through the worker harness, so that they compare with each other.
+    for (auto numInstances : options.instances) {
+        auto m = measureGraph(options, scenario, numInstances, length);
+        writeResult("graph", 1, numInstances, m);
+    }
+    for (auto numThreads : options.threads) {
+        for (auto numInstances : options.instances) {
+            auto m = measureThreads(options, scenario, numInstances, std::max(1, numThreads), length);
+            writeResult("threads", std::max(1, numThreads), numInstances, m);
+        }
+    }
+    out << std::endl << "  ]" << std::endl << "}" << std::endl;
+}
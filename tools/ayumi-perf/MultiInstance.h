@@ -0,0 +1,26 @@
+/*
+  ==============================================================================
+
+    Multi-instance scaling benchmark: many AyumiAudioProcessor instances,
+    each fed its own variation of a scenario, rendered both through a
+    juce::AudioProcessorGraph (one thread) and by a number of worker threads.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <ostream>
+#include <vector>
+#include "Scenarios.h"
+
+struct MultiInstanceOptions {
+    double sampleRate{48000};
+    int blockSize{256};
+    double seconds{2};
+    std::vector<int> instances{1, 2, 4, 8, 16, 32, 64, 128, 256};
+    std::vector<int> threads{1};
+};
+
+// Writes the results as JSON to `out`.
+void runMultiInstanceBenchmark(const MultiInstanceOptions& options, const Scenario& scenario, std::ostream& out);
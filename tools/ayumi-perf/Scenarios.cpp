@@ -0,0 +1,168 @@
+/*
+  ==============================================================================
+
+    Scripted MIDI scenarios for the processor benchmarks.
+
+  ==============================================================================
+*/
+
+#include "Scenarios.h"
+
+// Calls `f(position, index)` every `interval` samples in [0, length).
+template <typename F>
+static void every(juce::int64 length, double interval, F f)
+{
+    int index = 0;
+    for (double t = 0; t < (double) length; t += interval)
+        f((double) (juce::int64) t, index++);
+}
+
+// The SysEx messages of the README ("F0 7D 41 <command> <payload> F7"), without F0 and F7.
+static juce::MidiMessage registerFrame(const uint8_t* registers)
+{
+    uint8_t data[3 + 16]{0x7D, 0x41, 0x01};
+    for (int group = 0; group < 2; group++) {
+        auto out = data + 3 + group * 8;
+        for (int r = 0; r < 7; r++) {
+            out[0] |= (registers[group * 7 + r] >> 7) << r;
+            out[1 + r] = registers[group * 7 + r] & 0x7F;
+        }
+    }
+    return juce::MidiMessage::createSysExMessage(data, (int) sizeof(data));
+}
+
+static juce::MidiMessage channelPatch(int channel, int volume, int pan, int numStops, int stopMsec)
+{
+    uint8_t data[3 + 29]{0x7D, 0x41, 0x02, (uint8_t) channel, 2, (uint8_t) volume, (uint8_t) pan, (uint8_t) numStops};
+    for (int p = 0; p < 6; p++) {
+        int stopAt = stopMsec * (p + 1);
+        int ratio = 16383 - p * 2700;
+        uint8_t* out = data + 3 + 5 + p * 4;
+        out[0] = (uint8_t) ((stopAt >> 7) & 0x7F);
+        out[1] = (uint8_t) (stopAt & 0x7F);
+        out[2] = (uint8_t) ((ratio >> 7) & 0x7F);
+        out[3] = (uint8_t) (ratio & 0x7F);
+    }
+    return juce::MidiMessage::createSysExMessage(data, (int) sizeof(data));
+}
+
+static void setupChannels(juce::MidiMessageSequence& s)
+{
+    for (int ch = 1; ch <= 3; ch++) {
+        s.addEvent(juce::MidiMessage::controllerEvent(ch, 0x00, 2), 0); // noise off
+        s.addEvent(juce::MidiMessage::controllerEvent(ch, 0x07, 110), 0);
+        s.addEvent(juce::MidiMessage::controllerEvent(ch, 0x0A, 32 * ch), 0);
+    }
+}
+
+std::vector<Scenario> createScenarios(double sampleRate, juce::int64 length)
+{
+    std::vector<Scenario> scenarios;
+
+    {
+        // no notes (nothing is rendered while no note is on)
+        Scenario s{"idle", {}};
+        setupChannels(s.sequence);
+        scenarios.push_back(s);
+    }
+    {
+        // a chord held on all channels
+        Scenario s{"sustained", {}};
+        setupChannels(s.sequence);
+        for (int ch = 1; ch <= 3; ch++)
+            s.sequence.addEvent(juce::MidiMessage::noteOn(ch, 48 + ch * 4, (juce::uint8) 100), 0);
+        scenarios.push_back(s);
+    }
+    {
+        // a new note on every channel every 10ms
+        Scenario s{"arpeggio", {}};
+        setupChannels(s.sequence);
+        static const int pattern[] = {0, 4, 7, 12, 16, 12, 7, 4};
+        every(length, sampleRate * 0.01, [&](double t, int i) {
+            for (int ch = 1; ch <= 3; ch++) {
+                int note = 36 + ch * 12 + pattern[(i + ch) % 8];
+                if (i > 0)
+                    s.sequence.addEvent(juce::MidiMessage::noteOff(ch, 36 + ch * 12 + pattern[(i - 1 + ch) % 8]), t);
+                s.sequence.addEvent(juce::MidiMessage::noteOn(ch, note, (juce::uint8) 100), t);
+            }
+        });
+        scenarios.push_back(s);
+    }
+    {
+        // held notes with volume, pan and envelope CCs on every channel every 16 samples
+        Scenario s{"cc-storm", {}};
+        setupChannels(s.sequence);
+        for (int ch = 1; ch <= 3; ch++)
+            s.sequence.addEvent(juce::MidiMessage::noteOn(ch, 48 + ch * 4, (juce::uint8) 100), 0);
+        every(length, 16, [&](double t, int i) {
+            for (int ch = 1; ch <= 3; ch++) {
+                s.sequence.addEvent(juce::MidiMessage::controllerEvent(ch, 0x07, 64 + (i * 7 + ch) % 64), t);
+                s.sequence.addEvent(juce::MidiMessage::controllerEvent(ch, 0x0A, (i * 5 + ch * 40) % 128), t);
+                s.sequence.addEvent(juce::MidiMessage::controllerEvent(ch, 0x12, i % 128), t);
+            }
+        });
+        scenarios.push_back(s);
+    }
+    {
+        // an AY register frame every 20ms (as a 50Hz player would send), and a channel patch every 100ms
+        Scenario s{"sysex", {}};
+        setupChannels(s.sequence);
+        every(length, sampleRate * 0.02, [&](double t, int i) {
+            uint8_t registers[14]{};
+            for (int ch = 0; ch < 3; ch++) {
+                int period = 200 + ((i * 37 + ch * 91) % 800);
+                registers[ch * 2] = (uint8_t) (period & 0xFF);
+                registers[ch * 2 + 1] = (uint8_t) (period >> 8);
+                registers[8 + ch] = (uint8_t) (8 + (i + ch) % 8);
+            }
+            registers[6] = (uint8_t) (i % 32);
+            registers[7] = 0x38; // tones on, noise off
+            registers[11] = 0x40;
+            registers[13] = i % 25 == 0 ? 14 : 0xFF;
+            s.sequence.addEvent(registerFrame(registers), t);
+            if (i % 5 == 0)
+                s.sequence.addEvent(channelPatch(i / 5 % 3, 10 + i % 5, (i * 13) % 128, i % 7, 20), t);
+        });
+        scenarios.push_back(s);
+    }
+    {
+        // software envelopes on all channels, notes retriggered every 250ms
+        Scenario s{"soft-envelope", {}};
+        setupChannels(s.sequence);
+        for (int ch = 1; ch <= 3; ch++) {
+            s.sequence.addEvent(juce::MidiMessage::controllerEvent(ch, 0x20, 4), 0);
+            static const int stops[][2] = {{10, 127}, {20, 90}, {40, 60}, {60, 0}};
+            for (int p = 0; p < 4; p++) {
+                s.sequence.addEvent(juce::MidiMessage::controllerEvent(ch, 0x21 + p * 2, stops[p][0]), 0);
+                s.sequence.addEvent(juce::MidiMessage::controllerEvent(ch, 0x22 + p * 2, stops[p][1]), 0);
+            }
+        }
+        every(length, sampleRate * 0.25, [&](double t, int i) {
+            for (int ch = 1; ch <= 3; ch++) {
+                if (i > 0)
+                    s.sequence.addEvent(juce::MidiMessage::noteOff(ch, 48 + ch * 4 + (i - 1) % 5), t);
+                s.sequence.addEvent(juce::MidiMessage::noteOn(ch, 48 + ch * 4 + i % 5, (juce::uint8) 100), t);
+            }
+        });
+        scenarios.push_back(s);
+    }
+
+    for (auto& s : scenarios) {
+        s.sequence.sort();
+        s.sequence.updateMatchedPairs();
+    }
+    return scenarios;
+}
+
+void fillMidiBuffer(const juce::MidiMessageSequence& sequence, juce::MidiBuffer& midi, int& nextEvent,
+                    juce::int64 blockStart, int blockSize)
+{
+    midi.clear();
+    for (; nextEvent < sequence.getNumEvents(); nextEvent++) {
+        auto& message = sequence.getEventPointer(nextEvent)->message;
+        auto position = (juce::int64) message.getTimeStamp();
+        if (position >= blockStart + blockSize)
+            break;
+        midi.addEvent(message, (int) (position - blockStart));
+    }
+}
@@ -0,0 +1,25 @@
+/*
+  ==============================================================================
+
+    Scripted MIDI scenarios for the processor benchmarks.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <vector>
+#include <juce_audio_basics/juce_audio_basics.h>
+
+struct Scenario {
+    const char* name;
+    // events with timestamps in samples
+    juce::MidiMessageSequence sequence;
+};
+
+// Builds every scenario, `lengthInSamples` long.
+std::vector<Scenario> createScenarios(double sampleRate, juce::int64 lengthInSamples);
+
+// Copies the events of [blockStart, blockStart + blockSize) to `midi`, advancing `nextEvent`.
+void fillMidiBuffer(const juce::MidiMessageSequence& sequence, juce::MidiBuffer& midi, int& nextEvent,
+                    juce::int64 blockStart, int blockSize);
@@ -0,0 +1,142 @@
+/*
+  ==============================================================================
+
+    ayumi-render: renders Standard MIDI Files (or YM/VGM register logs) to
+    WAV (or raw float) files through AyumiAudioProcessor, without any plugin host.
+
+  ==============================================================================
+*/
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <juce_core/juce_core.h>
+#include <juce_events/juce_events.h>
+#include "OfflineRenderer.h"
+
+static void printUsage()
+{
+    std::cerr << "Usage: ayumi-render [options] input.mid [input2.mid ...]" << std::endl
+              << "Inputs with .ym or .vgm extension are played as register logs." << std::endl
+              << "Options:" << std::endl
+              << "  -o, --output-dir DIR   output directory (default: same as each input)" << std::endl
+              << "  -r, --sample-rate N    sample rate (default: 44100)" << std::endl
+              << "  -b, --block-size N     processing block size (default: 512)" << std::endl
+              << "  -t, --tail SECONDS     seconds to render after the last event (default: 1.0)" << std::endl
+              << "  -s, --start SECONDS    start the output at this position (default: 0)" << std::endl
+              << "  -c, --checkpoints SECONDS" << std::endl
+              << "                         save engine snapshots at this interval to OUTPUT.checkpoints, so that" << std::endl
+              << "                         later renders with --start resume from them instead of the top" << std::endl
+              << "  -p, --parallel N       split each file into N segments rendered in parallel (default: 1)" << std::endl
+              << "      --verify           render each file in parallel and serially, and report any difference" << std::endl
+              << "                         (no output file is written)" << std::endl
+              << "      --tone-cache       render steady tone-only passages from the tone cache (faster, approximate)" << std::endl
+              << "  -f, --format FORMAT    wav16, wav24, wav32 (float) or raw (interleaved float) (default: wav16)" << std::endl
+              << "  -j, --jobs N           number of files rendered in parallel (default: number of CPUs)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    OfflineRenderer::Options options;
+    juce::File outputDir;
+    juce::String format{"wav16"};
+    int numJobs = juce::SystemStats::getNumCpus();
+    bool verify = false;
+    std::vector<juce::File> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        juce::String arg{argv[i]};
+        bool hasValue = i + 1 < argc;
+        if ((arg == "-o" || arg == "--output-dir") && hasValue)
+            outputDir = juce::File::getCurrentWorkingDirectory().getChildFile(argv[++i]);
+        else if ((arg == "-r" || arg == "--sample-rate") && hasValue)
+            options.sampleRate = juce::String(argv[++i]).getDoubleValue();
+        else if ((arg == "-b" || arg == "--block-size") && hasValue)
+            options.blockSize = juce::String(argv[++i]).getIntValue();
+        else if ((arg == "-t" || arg == "--tail") && hasValue)
+            options.tailSeconds = juce::String(argv[++i]).getDoubleValue();
+        else if ((arg == "-s" || arg == "--start") && hasValue)
+            options.startSeconds = juce::String(argv[++i]).getDoubleValue();
+        else if ((arg == "-c" || arg == "--checkpoints") && hasValue)
+            options.checkpointSeconds = juce::String(argv[++i]).getDoubleValue();
+        else if ((arg == "-p" || arg == "--parallel") && hasValue)
+            options.numSegments = std::max(1, juce::String(argv[++i]).getIntValue());
+        else if (arg == "--verify")
+            verify = true;
+        else if (arg == "--tone-cache")
+            options.toneCache = true;
+        else if ((arg == "-f" || arg == "--format") && hasValue)
+            format = argv[++i];
+        else if ((arg == "-j" || arg == "--jobs") && hasValue)
+            numJobs = juce::String(argv[++i]).getIntValue();
+        else if (arg == "-h" || arg == "--help") {
+            printUsage();
+            return 0;
+        } else if (arg.startsWith("-")) {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage();
+            return 1;
+        } else
+            inputs.push_back(juce::File::getCurrentWorkingDirectory().getChildFile(arg));
+    }
+
+    if (inputs.empty() || options.sampleRate <= 0 || options.blockSize <= 0
+        || (format != "wav16" && format != "wav24" && format != "wav32" && format != "raw")) {
+        printUsage();
+        return 1;
+    }
+    if (outputDir != juce::File{})
+        outputDir.createDirectory();
+
+    // Each file gets its own processor instance, so files can be rendered in parallel.
+    std::atomic<size_t> nextInput{0};
+    std::atomic<int> numFailures{0};
+    auto worker = [&]() {
+        for (size_t index = nextInput++; index < inputs.size(); index = nextInput++) {
+            auto& input = inputs[index];
+            auto dir = outputDir == juce::File{} ? input.getParentDirectory() : outputDir;
+            auto output = dir.getChildFile(input.getFileNameWithoutExtension()).withFileExtension(format == "raw" ? "raw" : "wav");
+
+            juce::String error;
+            OfflineRenderer renderer{options};
+            bool ok = input.hasFileExtension("ym;vgm") ? renderer.loadRegisterLog(input, error)
+                                                       : renderer.loadMidiFile(input, error);
+            auto checkpointFile = output.getSiblingFile(output.getFileName() + ".checkpoints");
+            juce::String checkpointError;
+            if (ok && options.startSeconds > 0 && checkpointFile.existsAsFile()
+                && !renderer.loadCheckpoints(checkpointFile, checkpointError))
+                std::cerr << "Warning: " << checkpointError << std::endl;
+            if (ok && verify) {
+                juce::String report;
+                ok = renderer.verifyParallel(report);
+                std::cout << input.getFullPathName() << ": " << report << std::endl;
+                if (!ok)
+                    numFailures++;
+                continue;
+            }
+            if (ok && format == "raw")
+                ok = OfflineRenderer::renderToRawFloat(renderer, output, error);
+            else if (ok)
+                ok = OfflineRenderer::renderToWav(renderer, output, format.substring(3).getIntValue(), error);
+            if (ok && options.checkpointSeconds > 0)
+                ok = renderer.saveCheckpoints(checkpointFile, error);
+
+            if (!ok) {
+                numFailures++;
+                std::cerr << input.getFullPathName() << ": " << error << std::endl;
+            } else
+                std::cout << output.getFullPathName() << std::endl;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < std::max(1, std::min(numJobs, (int) inputs.size())); i++)
+        threads.emplace_back(worker);
+    for (auto& t : threads)
+        t.join();
+
+    return numFailures > 0 ? 1 : 0;
+}
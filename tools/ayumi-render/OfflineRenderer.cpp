@@ -0,0 +1,379 @@
+/*
+  ==============================================================================
+
+    Offline (faster than realtime) renderer that drives AyumiAudioProcessor
+    with the events from a Standard MIDI File, or plays a register log (YM/VGM).
+
+  ==============================================================================
+*/
+
+#include "OfflineRenderer.h"
+
+#define OFFLINE_RENDERER_CHECKPOINTS_MAGIC_NUMBER 0x50434141 // "AACP"
+
+OfflineRenderer::OfflineRenderer(const Options& options) : options(options)
+{
+}
+
+bool OfflineRenderer::loadMidiFile(const juce::File& file, juce::String& error)
+{
+    juce::FileInputStream stream{file};
+    if (!stream.openedOk()) {
+        error = "Cannot open " + file.getFullPathName();
+        return false;
+    }
+    juce::MidiFile midiFile;
+    if (!midiFile.readFrom(stream)) {
+        error = "Invalid MIDI file: " + file.getFullPathName();
+        return false;
+    }
+    midiFile.convertTimestampTicksToSeconds();
+
+    sequence = {};
+    for (int t = 0; t < midiFile.getNumTracks(); t++)
+        sequence.addSequence(*midiFile.getTrack(t), 0.0);
+    sequence.sort();
+
+    // We only need channel messages and SysEx; drop meta events and convert seconds to samples.
+    for (int i = sequence.getNumEvents() - 1; i >= 0; i--) {
+        auto& message = sequence.getEventPointer(i)->message;
+        if (message.isMetaEvent())
+            sequence.deleteEvent(i, false);
+        else
+            message.setTimeStamp(std::floor(message.getTimeStamp() * options.sampleRate));
+    }
+
+    registerLogFile = juce::File{};
+    lengthInSamples = (juce::int64) (midiFile.getLastTimestamp() * options.sampleRate
+                                     + options.tailSeconds * options.sampleRate);
+    return true;
+}
+
+bool OfflineRenderer::loadRegisterLog(const juce::File& file, juce::String& error)
+{
+    // only the header is parsed here (for the length); the processor maps the file again by itself.
+    juce::MemoryMappedFile mapped{file, juce::MemoryMappedFile::readOnly};
+    RegisterLogPlayer player;
+    const char* message;
+    if (mapped.getData() == nullptr) {
+        error = "Cannot open " + file.getFullPathName();
+        return false;
+    }
+    if (!player.open((const uint8_t*) mapped.getData(), mapped.getSize(), &message)) {
+        error = juce::String{message} + ": " + file.getFullPathName();
+        return false;
+    }
+
+    sequence = {};
+    registerLogFile = file;
+    lengthInSamples = (juce::int64) (player.getLengthInSeconds() * options.sampleRate
+                                     + options.tailSeconds * options.sampleRate);
+    return true;
+}
+
+void OfflineRenderer::prepareProcessor(AyumiAudioProcessor& processor)
+{
+    processor.setNonRealtime(true);
+    processor.setToneCacheEnabled(options.toneCache);
+    processor.setRateAndBufferSizeDetails(options.sampleRate, options.blockSize);
+    processor.prepareToPlay(options.sampleRate, options.blockSize);
+}
+
+void OfflineRenderer::fillMidiBuffer(juce::MidiBuffer& midi, int& nextEvent, juce::int64 blockStart, int blockSize)
+{
+    midi.clear();
+    for (; nextEvent < sequence.getNumEvents(); nextEvent++) {
+        auto& message = sequence.getEventPointer(nextEvent)->message;
+        auto position = (juce::int64) message.getTimeStamp();
+        if (position >= blockStart + blockSize)
+            break;
+        midi.addEvent(message, (int) (position - blockStart));
+    }
+}
+
+bool OfflineRenderer::render(const Sink& sink, juce::String& error)
+{
+    if (options.numSegments > 1)
+        return renderParallel(sink, error);
+    return renderRange((juce::int64) (options.startSeconds * options.sampleRate), lengthInSamples, true, sink, error);
+}
+
+bool OfflineRenderer::renderRange(juce::int64 startPosition, juce::int64 endPosition, bool takeCheckpoints, const Sink& sink,
+                                  juce::String& error)
+{
+    AyumiAudioProcessor processor;
+    prepareProcessor(processor);
+    if (registerLogFile != juce::File{} && !processor.loadRegisterLog(registerLogFile, error, false))
+        return false;
+
+    juce::AudioBuffer<float> buffer{processor.getTotalNumOutputChannels(), options.blockSize};
+    juce::MidiBuffer midi;
+    midi.ensureSize(4096);
+
+    // Resume from the last checkpoint at or before the start position, if any. Then fast-forward up to
+    // the pre-roll. Everything happens on the same block grid as a full render, so the result is identical to it.
+    juce::int64 position = 0;
+    for (auto it = checkpoints.rbegin(); it != checkpoints.rend(); ++it) {
+        if (it->position <= startPosition && processor.restoreSnapshot(it->snapshot.getData(), it->snapshot.getSize())) {
+            position = it->position;
+            break;
+        }
+    }
+    int nextEvent = 0;
+    while (nextEvent < sequence.getNumEvents() && sequence.getEventPointer(nextEvent)->message.getTimeStamp() < position)
+        nextEvent++;
+
+    juce::int64 checkpointInterval = options.checkpointSeconds <= 0 ? 0 : options.blockSize
+            * (juce::int64) std::max(1, (int) std::round(options.checkpointSeconds * options.sampleRate / options.blockSize));
+
+    for (; position < endPosition; position += options.blockSize) {
+        if (takeCheckpoints && checkpointInterval > 0 && position % checkpointInterval == 0
+            && (checkpoints.empty() || checkpoints.back().position < position)) {
+            checkpoints.push_back({position, {}});
+            processor.saveSnapshot(checkpoints.back().snapshot);
+        }
+        // (the pre-roll length depends on the clock, which may change at the first block for register logs)
+        processor.setFastForward(position + options.blockSize <= processor.getPrerollStart(startPosition));
+        fillMidiBuffer(midi, nextEvent, position, options.blockSize);
+        buffer.clear();
+        processor.processBlock(buffer, midi);
+        auto end = std::min(position + options.blockSize, endPosition);
+        auto from = std::max(position, startPosition);
+        if (from < end && !sink(buffer, (int) (from - position), (int) (end - from)))
+            return false;
+    }
+
+    processor.releaseResources();
+    return true;
+}
+
+bool OfflineRenderer::renderToWav(OfflineRenderer& renderer, const juce::File& file, int bitsPerSample, juce::String& error)
+{
+    file.deleteFile();
+    std::unique_ptr<juce::OutputStream> stream{new juce::FileOutputStream(file)};
+    if (!static_cast<juce::FileOutputStream*>(stream.get())->openedOk()) {
+        error = "Cannot create " + file.getFullPathName();
+        return false;
+    }
+
+    juce::WavAudioFormat format;
+    std::unique_ptr<juce::AudioFormatWriter> writer{format.createWriterFor(
+            stream.get(), renderer.options.sampleRate, 2, bitsPerSample, {}, 0)};
+    if (writer == nullptr) {
+        error = "Cannot write WAV with " + juce::String(bitsPerSample) + " bits per sample";
+        return false;
+    }
+    stream.release(); // now owned by the writer
+
+    bool ok = renderer.render([&](const juce::AudioBuffer<float>& buffer, int startSample, int numSamples) {
+        return writer->writeFromAudioSampleBuffer(buffer, startSample, numSamples);
+    }, error);
+    if (!ok && error.isEmpty())
+        error = "Cannot write " + file.getFullPathName();
+    return ok;
+}
+
+bool OfflineRenderer::renderToRawFloat(OfflineRenderer& renderer, const juce::File& file, juce::String& error)
+{
+    file.deleteFile();
+    juce::FileOutputStream stream{file};
+    if (!stream.openedOk()) {
+        error = "Cannot create " + file.getFullPathName();
+        return false;
+    }
+
+    std::vector<float> interleaved;
+    bool ok = renderer.render([&](const juce::AudioBuffer<float>& buffer, int startSample, int numSamples) {
+        return writeInterleaved(stream, buffer, startSample, numSamples, interleaved);
+    }, error);
+    if (!ok && error.isEmpty())
+        error = "Cannot write " + file.getFullPathName();
+    return ok;
+}
+
+// interleaved 32-bit float, in native byte order (little endian on every platform we support).
+bool OfflineRenderer::writeInterleaved(juce::OutputStream& stream, const juce::AudioBuffer<float>& buffer,
+                                       int startSample, int numSamples, std::vector<float>& interleaved)
+{
+    auto numChannels = buffer.getNumChannels();
+    interleaved.resize((size_t) (numSamples * numChannels));
+    for (int ch = 0; ch < numChannels; ch++) {
+        auto src = buffer.getReadPointer(ch, startSample);
+        for (int i = 0; i < numSamples; i++)
+            interleaved[(size_t) (i * numChannels + ch)] = src[i];
+    }
+    return stream.write(interleaved.data(), interleaved.size() * sizeof(float));
+}
+
+bool OfflineRenderer::renderParallel(const Sink& sink, juce::String& error)
+{
+    // Segments are on the block grid. Each of them is rendered (after fast-forward and pre-roll) by its own
+    // processor and thread into a temporary file, then they are passed to the sink in order.
+    struct Segment {
+        juce::int64 start;
+        juce::int64 end;
+        juce::TemporaryFile file{".raw"};
+        int numChannels{0};
+        bool ok{false};
+        juce::String error{};
+    };
+    auto startPosition = (juce::int64) (options.startSeconds * options.sampleRate);
+    auto numBlocks = (lengthInSamples - startPosition + options.blockSize - 1) / options.blockSize;
+    auto blocksPerSegment = std::max((juce::int64) 1, (numBlocks + options.numSegments - 1) / options.numSegments);
+    std::vector<std::unique_ptr<Segment>> segments;
+    for (auto start = startPosition; start < lengthInSamples; start += blocksPerSegment * options.blockSize) {
+        segments.emplace_back(new Segment());
+        segments.back()->start = start;
+        segments.back()->end = std::min(lengthInSamples, start + blocksPerSegment * options.blockSize);
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& segment : segments) {
+        threads.emplace_back([this, &segment]() {
+            juce::FileOutputStream stream{segment->file.getFile()};
+            std::vector<float> interleaved;
+            if (!stream.openedOk()) {
+                segment->error = "Cannot create " + segment->file.getFile().getFullPathName();
+                return;
+            }
+            segment->ok = renderRange(segment->start, segment->end, false,
+                    [&](const juce::AudioBuffer<float>& buffer, int startSample, int numSamples) {
+                        segment->numChannels = buffer.getNumChannels();
+                        return writeInterleaved(stream, buffer, startSample, numSamples, interleaved);
+                    }, segment->error);
+            if (!segment->ok && segment->error.isEmpty())
+                segment->error = "Cannot write " + segment->file.getFile().getFullPathName();
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    std::vector<float> interleaved;
+    for (auto& segment : segments) {
+        if (!segment->ok) {
+            error = segment->error;
+            return false;
+        }
+        juce::FileInputStream stream{segment->file.getFile()};
+        if (!stream.openedOk()) {
+            error = "Cannot open " + segment->file.getFile().getFullPathName();
+            return false;
+        }
+        juce::AudioBuffer<float> buffer{std::max(1, segment->numChannels), options.blockSize};
+        for (auto position = segment->start; position < segment->end; position += options.blockSize) {
+            auto numSamples = (int) std::min((juce::int64) options.blockSize, segment->end - position);
+            interleaved.resize((size_t) (numSamples * buffer.getNumChannels()));
+            stream.read(interleaved.data(), (int) (interleaved.size() * sizeof(float)));
+            for (int ch = 0; ch < buffer.getNumChannels(); ch++) {
+                auto dst = buffer.getWritePointer(ch);
+                for (int i = 0; i < numSamples; i++)
+                    dst[i] = interleaved[(size_t) (i * buffer.getNumChannels() + ch)];
+            }
+            if (!sink(buffer, 0, numSamples))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool OfflineRenderer::verifyParallel(juce::String& report)
+{
+    // the parallel output goes to a temporary file, and the serial render is compared to it.
+    juce::TemporaryFile parallelFile{".raw"};
+    juce::String error;
+    {
+        juce::FileOutputStream stream{parallelFile.getFile()};
+        std::vector<float> interleaved;
+        if (!stream.openedOk() || !renderParallel([&](const juce::AudioBuffer<float>& buffer, int startSample, int numSamples) {
+                return writeInterleaved(stream, buffer, startSample, numSamples, interleaved);
+            }, error)) {
+            report = "Parallel rendering failed" + (error.isEmpty() ? juce::String{} : ": " + error);
+            return false;
+        }
+    }
+
+    juce::FileInputStream stream{parallelFile.getFile()};
+    std::vector<float> parallel;
+    juce::int64 position = (juce::int64) (options.startSeconds * options.sampleRate);
+    juce::int64 numMismatches = 0, firstMismatch = -1;
+    float maxDifference = 0;
+    bool ok = stream.openedOk() && renderRange(position, lengthInSamples, false,
+            [&](const juce::AudioBuffer<float>& buffer, int startSample, int numSamples) {
+                auto numChannels = buffer.getNumChannels();
+                parallel.resize((size_t) (numSamples * numChannels));
+                if (stream.read(parallel.data(), (int) (parallel.size() * sizeof(float))) != (int) (parallel.size() * sizeof(float)))
+                    return false;
+                for (int i = 0; i < numSamples; i++) {
+                    bool same = true;
+                    for (int ch = 0; ch < numChannels; ch++) {
+                        auto serial = buffer.getSample(ch, startSample + i);
+                        auto other = parallel[(size_t) (i * numChannels + ch)];
+                        same &= memcmp(&serial, &other, sizeof(float)) == 0;
+                        maxDifference = std::max(maxDifference, std::abs(serial - other));
+                    }
+                    if (!same && numMismatches++ == 0)
+                        firstMismatch = position + i;
+                }
+                position += numSamples;
+                return true;
+            }, error);
+    if (!ok) {
+        report = error.isNotEmpty() ? "Serial rendering failed: " + error
+                                    : "Serial rendering failed (or the parallel output is shorter)";
+        return false;
+    }
+    if (numMismatches == 0)
+        report = "Parallel output (" + juce::String(options.numSegments) + " segments) is bit-identical to serial output";
+    else
+        report = juce::String(numMismatches) + " samples differ from serial output, first at sample "
+                 + juce::String(firstMismatch) + ", max difference " + juce::String(maxDifference);
+    return numMismatches == 0;
+}
+
+bool OfflineRenderer::saveCheckpoints(const juce::File& file, juce::String& error) const
+{
+    file.deleteFile();
+    juce::FileOutputStream stream{file};
+    if (!stream.openedOk()) {
+        error = "Cannot create " + file.getFullPathName();
+        return false;
+    }
+    stream.writeInt(OFFLINE_RENDERER_CHECKPOINTS_MAGIC_NUMBER);
+    stream.writeDouble(options.sampleRate);
+    stream.writeInt(options.blockSize);
+    stream.writeInt64(lengthInSamples);
+    stream.writeInt((int) checkpoints.size());
+    for (auto& checkpoint : checkpoints) {
+        stream.writeInt64(checkpoint.position);
+        stream.writeInt((int) checkpoint.snapshot.getSize());
+        stream.write(checkpoint.snapshot.getData(), checkpoint.snapshot.getSize());
+    }
+    stream.flush();
+    return true;
+}
+
+bool OfflineRenderer::loadCheckpoints(const juce::File& file, juce::String& error)
+{
+    juce::FileInputStream stream{file};
+    if (!stream.openedOk()) {
+        error = "Cannot open " + file.getFullPathName();
+        return false;
+    }
+    if (stream.readInt() != OFFLINE_RENDERER_CHECKPOINTS_MAGIC_NUMBER || stream.readDouble() != options.sampleRate
+        || stream.readInt() != options.blockSize || stream.readInt64() != lengthInSamples) {
+        error = "Checkpoints do not match the song or the options: " + file.getFullPathName();
+        return false;
+    }
+    std::vector<Checkpoint> loaded;
+    for (int i = 0, n = stream.readInt(); i < n; i++) {
+        Checkpoint checkpoint{stream.readInt64(), {}};
+        auto size = stream.readInt();
+        if (size <= 0 || stream.readIntoMemoryBlock(checkpoint.snapshot, size) != (size_t) size) {
+            error = "Truncated checkpoints: " + file.getFullPathName();
+            return false;
+        }
+        loaded.push_back(std::move(checkpoint));
+    }
+    checkpoints = std::move(loaded);
+    return true;
+}
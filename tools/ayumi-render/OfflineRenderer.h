@@ -0,0 +1,82 @@
+/*
+  ==============================================================================
+
+    Offline (faster than realtime) renderer that drives AyumiAudioProcessor
+    with the events from a Standard MIDI File, or plays a register log (YM/VGM).
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <vector>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_audio_formats/juce_audio_formats.h>
+#include "PluginProcessor.h"
+
+class OfflineRenderer
+{
+public:
+    struct Options {
+        double sampleRate{44100};
+        int blockSize{512};
+        double tailSeconds{1.0};
+        double startSeconds{0}; // the output starts at this position
+        double checkpointSeconds{0}; // interval of the checkpoints taken during render() (0: none)
+        int numSegments{1}; // if more than 1, the song is split into segments rendered in parallel
+        bool toneCache{false}; // see AyumiAudioProcessor::setToneCacheEnabled()
+    };
+
+    // receives every rendered block (only `numSamples` samples from `startSample` are part of the output).
+    typedef std::function<bool(const juce::AudioBuffer<float>& buffer, int startSample, int numSamples)> Sink;
+
+    explicit OfflineRenderer(const Options& options);
+
+    bool loadMidiFile(const juce::File& file, juce::String& error);
+    // YM or VGM file, played (without loops) through the processor's register log playback mode.
+    bool loadRegisterLog(const juce::File& file, juce::String& error);
+
+    juce::int64 getLengthInSamples() const { return lengthInSamples; }
+
+    // Renders the song (from `startSeconds`) through a new processor instance. If there is any checkpoint
+    // at or before the start position, rendering resumes from it instead of the top of the song.
+    // On failure, `error` tells why (it is left empty if the sink stopped rendering).
+    bool render(const Sink& sink, juce::String& error);
+
+    // Renders the song both in parallel (in `numSegments` segments) and serially, and compares them.
+    bool verifyParallel(juce::String& report);
+
+    // Checkpoints are engine snapshots on the block grid. They are valid only for the same song, sample rate,
+    // block size and build.
+    size_t getNumCheckpoints() const { return checkpoints.size(); }
+    bool saveCheckpoints(const juce::File& file, juce::String& error) const;
+    bool loadCheckpoints(const juce::File& file, juce::String& error);
+
+    // Convenience sinks
+    static bool renderToWav(OfflineRenderer& renderer, const juce::File& file, int bitsPerSample, juce::String& error);
+    static bool renderToRawFloat(OfflineRenderer& renderer, const juce::File& file, juce::String& error);
+
+private:
+    Options options;
+    juce::MidiMessageSequence sequence{}; // timestamps are in samples
+    juce::File registerLogFile{};
+    juce::int64 lengthInSamples{0};
+
+    struct Checkpoint {
+        juce::int64 position; // in samples, at the top of a block
+        juce::MemoryBlock snapshot;
+    };
+    std::vector<Checkpoint> checkpoints{}; // sorted by position
+
+    void prepareProcessor(AyumiAudioProcessor& processor);
+    void fillMidiBuffer(juce::MidiBuffer& midi, int& nextEvent, juce::int64 blockStart, int blockSize);
+    // Renders [startPosition, endPosition). Frames before the start are restored from a checkpoint,
+    // fast-forwarded and pre-rolled, so the result is bit-identical to the same range of a full render.
+    bool renderRange(juce::int64 startPosition, juce::int64 endPosition, bool takeCheckpoints, const Sink& sink,
+                     juce::String& error);
+    bool renderParallel(const Sink& sink, juce::String& error);
+    static bool writeInterleaved(juce::OutputStream& stream, const juce::AudioBuffer<float>& buffer,
+                                 int startSample, int numSamples, std::vector<float>& interleaved);
+};